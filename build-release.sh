@@ -0,0 +1,5 @@
+#!/bin/bash
+set -xeu
+FLAGS="-Wall -Wextra -pedantic -O2 -march=native -DNDEBUG -pthread"
+g++ $FLAGS src/main.cpp -o decision-tree $@
+g++ $FLAGS src/bench.cpp -o bench $@
@@ -1,3 +1,3 @@
 #!/bin/bash
 set -xeu
-g++ -Wall -Wextra -pedantic -g src/main.cpp $@
+g++ -Wall -Wextra -pedantic -g -pthread src/main.cpp $@
@@ -0,0 +1,337 @@
+#include "library.cpp"
+
+// Benchmark: generates a synthetic dataset, then times parsing, categorizing, building the tree and classifying,
+// and prints results as JSON.
+
+#define BENCH_MAX_COLUMNS (1 << 16)
+#define BENCH_MAX_CARDINALITY (1 << 24)
+#define BENCH_MAX_THREADS 1024
+
+struct SyntheticDatasetOptions
+{
+  size_t rows = 1000000;
+  size_t samples = 1000000;
+  size_t integers = 4;
+  size_t decimals = 4;
+  size_t strings = 2;
+  size_t cardinality = 8;
+  size_t classes = 3;
+  // Part of rows which get a random class.
+  f64 noise = 0.1;
+  uint64_t seed = 1;
+};
+
+// Writes training file with header, ID column and class, and samples file with only the feature columns.
+// Class depends on the first few columns, so there is something to learn.
+void
+generate_synthetic_dataset(const char *train_path, const char *samples_path, SyntheticDatasetOptions &options)
+{
+  auto random = Random{ options.seed };
+  auto cols = options.integers + options.decimals + options.strings;
+  auto features = std::vector<size_t>{ };
+  features.resize(cols);
+
+  auto write_file =
+    [&](const char *filepath, size_t rows, bool is_train)
+    {
+      auto file = std::ofstream{ filepath, std::ios::binary };
+      auto line = std::string{ };
+      char buffer[32];
+
+      if (is_train)
+        {
+          line.append("ID");
+          for (size_t col = 0; col < cols; col++)
+            line.append(",c" + std::to_string(col));
+          line.append(",class\n");
+          file << line;
+        }
+
+      for (size_t row = 0; row < rows; row++)
+        {
+          line.clear();
+
+          if (is_train)
+            {
+              line.append(std::to_string(row));
+              line.push_back(',');
+            }
+
+          for (size_t col = 0; col < cols; col++)
+            {
+              if (col != 0)
+                line.push_back(',');
+
+              if (col < options.integers)
+                {
+                  auto value = random.below(options.cardinality);
+                  features[col] = value;
+                  line.append(std::to_string(value));
+                }
+              else if (col < options.integers + options.decimals)
+                {
+                  auto value = random.unit() * 1000;
+                  features[col] = size_t(value / 1000 * options.cardinality);
+                  snprintf(buffer, sizeof(buffer), "%.3f", value);
+                  line.append(buffer);
+                }
+              else
+                {
+                  auto value = random.below(options.cardinality);
+                  features[col] = value;
+                  line.push_back('s');
+                  line.append(std::to_string(value));
+                }
+            }
+
+          if (is_train)
+            {
+              size_t goal = 0;
+              for (size_t col = 0; col < std::min(cols, size_t(3)); col++)
+                goal += features[col];
+              goal %= options.classes;
+
+              if (random.unit() < options.noise)
+                goal = random.below(options.classes);
+
+              line.append(",class");
+              line.append(std::to_string(goal));
+            }
+
+          line.push_back('\n');
+          file << line;
+        }
+
+      file.close();
+      if (!file)
+        {
+          fprintf(stderr, "error: couldn't write '%s'.\n", filepath);
+          exit(EXIT_FAILURE);
+        }
+    };
+
+  write_file(train_path, options.rows, true);
+  write_file(samples_path, options.samples, false);
+}
+
+size_t
+file_size(const char *filepath)
+{
+  struct stat stats;
+  if (stat(filepath, &stats) == -1)
+    return 0;
+  return stats.st_size;
+}
+
+struct PhaseTiming
+{
+  const char *name;
+  f64 seconds;
+  size_t rows;
+  size_t bytes;
+};
+
+int
+main(int argc, char **argv)
+{
+  auto dataset = SyntheticDatasetOptions{ };
+  auto options = CategorizeOptions{ };
+  auto forest_options = ForestOptions{ };
+  options.thread_count = std::thread::hardware_concurrency();
+  auto prefix = std::string{ "/tmp/decision-tree-bench" };
+  size_t repeat = 1;
+  auto show_stats = false;
+  auto level_wise = false;
+  auto online = false;
+
+  for (int i = 1; i < argc; i++)
+    {
+      auto arg = std::string_view{ argv[i] };
+      auto has_value = i + 1 < argc;
+
+      if (arg == "--rows" && has_value)
+        dataset.rows = parse_count("count of rows", argv[++i], 1, std::numeric_limits<RowIndex>::max());
+      else if (arg == "--samples" && has_value)
+        dataset.samples = parse_count("count of samples", argv[++i], 1, std::numeric_limits<RowIndex>::max());
+      else if (arg == "--integers" && has_value)
+        dataset.integers = parse_count("count of integer columns", argv[++i], 0, BENCH_MAX_COLUMNS);
+      else if (arg == "--decimals" && has_value)
+        dataset.decimals = parse_count("count of decimal columns", argv[++i], 0, BENCH_MAX_COLUMNS);
+      else if (arg == "--strings" && has_value)
+        dataset.strings = parse_count("count of string columns", argv[++i], 0, BENCH_MAX_COLUMNS);
+      else if (arg == "--cardinality" && has_value)
+        dataset.cardinality = parse_count("cardinality", argv[++i], 1, BENCH_MAX_CARDINALITY);
+      else if (arg == "--classes" && has_value)
+        dataset.classes = parse_count("count of classes", argv[++i], 1, BENCH_MAX_CARDINALITY);
+      else if (arg == "--noise" && has_value)
+        {
+          auto text = argv[++i];
+          char *end = nullptr;
+          errno = 0;
+          dataset.noise = strtod(text, &end);
+
+          // Also rejects NaN.
+          if (end == text || *end != '\0' || errno != 0 || !(dataset.noise >= 0 && dataset.noise <= 1))
+            {
+              fprintf(stderr, "error: noise should be a number from 0 to 1, but got '%s'.\n", text);
+              exit(EXIT_FAILURE);
+            }
+        }
+      else if (arg == "--seed" && has_value)
+        dataset.seed = parse_count("seed", argv[++i], 0, SIZE_MAX);
+      else if (arg == "--threads" && has_value)
+        options.thread_count = parse_count("count of threads", argv[++i], 1, BENCH_MAX_THREADS);
+      else if (arg == "--bins" && has_value)
+        options.bins_count = parse_count("bins count", argv[++i], 1, MAX_BINS_COUNT);
+      else if (arg == "--quantile-bins")
+        options.binning = Binning_Quantiles;
+      else if (arg == "--repeat" && has_value)
+        repeat = parse_count("count of runs", argv[++i], 1, SIZE_MAX);
+      else if (arg == "--output" && has_value)
+        prefix = argv[++i];
+      else if (arg == "--stats")
+        show_stats = true;
+      else if (arg == "--forest" && has_value)
+        forest_options.tree_count = parse_count("count of trees", argv[++i], 1, MAX_FOREST_TREE_COUNT);
+      else if (arg == "--forest-features" && has_value)
+        forest_options.feature_count = parse_count("count of features", argv[++i], 1, SIZE_MAX);
+      else if (arg == "--level-wise")
+        level_wise = true;
+      else if (arg == "--online")
+        online = true;
+      else
+        {
+          fprintf(stderr, "error: unknown argument '%s'.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+    }
+
+  if (dataset.integers + dataset.decimals + dataset.strings < 2)
+    {
+      fprintf(stderr, "error: there should be at least two columns.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  if (online && forest_options.tree_count > 0)
+    {
+      fprintf(stderr, "error: forests can't be updated online.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  options.thread_count = std::max(options.thread_count, size_t(1));
+
+  auto train_path = prefix + ".csv";
+  auto samples_path = prefix + ".samples.csv";
+  generate_synthetic_dataset(train_path.c_str(), samples_path.c_str(), dataset);
+
+  auto train_bytes = file_size(train_path.c_str());
+  auto samples_bytes = file_size(samples_path.c_str());
+
+  PhaseTiming phases[] = {
+    { "parse", DBL_MAX, dataset.rows, train_bytes },
+    { "categorize", DBL_MAX, dataset.rows, train_bytes },
+    { "build", DBL_MAX, dataset.rows, train_bytes },
+    { "classify", DBL_MAX, dataset.samples, samples_bytes },
+    // Built tree learns from all training rows once more.
+    { "update", DBL_MAX, dataset.rows, train_bytes },
+  };
+
+  auto phase_count = std::size(phases) - !online;
+
+  size_t node_count = 0;
+
+  // Stats cover all runs, and are printed to standard error.
+  if (show_stats)
+    stats_start();
+
+  // Every phase takes the best of all runs.
+  for (size_t run = 0; run < repeat; run++)
+    {
+      auto time = [&](size_t phase, auto &&function)
+      {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+        phases[phase].seconds = std::min(phases[phase].seconds, seconds);
+      };
+
+      auto table = Table{ };
+      auto categories = Categories{ };
+      auto tree = DecisionTree{ };
+      auto forest = DecisionForest{ };
+
+      time(0, [&]() { table = parse_csv_from_file(train_path.c_str()); });
+      time(1, [&]() { categories = categorize(table, options); });
+      time(2, [&]()
+      {
+        if (forest_options.tree_count > 0)
+          {
+            auto columns = encode_columns(table, categories);
+            forest = build_decision_forest(columns, categories, forest_options, options.thread_count);
+          }
+        else if (level_wise)
+          {
+            auto columns = encode_columns(table, categories);
+            tree = build_decision_tree_level_wise(columns, categories);
+          }
+        else
+          {
+            tree = build_decision_tree(table, categories, options.thread_count);
+          }
+      });
+
+      auto samples = parse_csv_from_string_in_parallel(samples_path.c_str(), map_entire_file(samples_path.c_str()), false, options.thread_count);
+      auto results = std::vector<CategoryId>{ };
+      results.resize(samples.rows);
+
+      time(3, [&]()
+      {
+        if (forest_options.tree_count > 0)
+          forest.classify_batch(samples, 0, samples.rows, results.data());
+        else
+          tree.classify_batch(samples, 0, samples.rows, results.data());
+      });
+
+      if (online)
+        {
+          time(4, [&]()
+          {
+            auto online_options = OnlineOptions{ };
+            auto updater = start_online_updates(tree, online_options);
+            updater.update(table, 0, table.rows);
+            updater.compile();
+          });
+        }
+
+      node_count = tree.nodes.size();
+      for (auto &forest_tree: forest.trees)
+        node_count += forest_tree.nodes.size();
+    }
+
+  printf("{\n");
+  printf("  \"rows\": %zu,\n", dataset.rows);
+  printf("  \"samples\": %zu,\n", dataset.samples);
+  printf("  \"columns\": { \"integers\": %zu, \"decimals\": %zu, \"strings\": %zu },\n",
+         dataset.integers, dataset.decimals, dataset.strings);
+  printf("  \"cardinality\": %zu,\n", dataset.cardinality);
+  printf("  \"classes\": %zu,\n", dataset.classes);
+  printf("  \"threads\": %zu,\n", options.thread_count);
+  printf("  \"repeat\": %zu,\n", repeat);
+  printf("  \"trees\": %zu,\n", std::max(forest_options.tree_count, size_t(1)));
+  printf("  \"builder\": \"%s\",\n", forest_options.tree_count > 0 ? "forest" : level_wise ? "level_wise" : "recursive");
+  printf("  \"nodes\": %zu,\n", node_count);
+  printf("  \"phases\": {\n");
+
+  for (size_t i = 0; i < phase_count; i++)
+    {
+      auto &phase = phases[i];
+      printf("    \"%s\": { \"seconds\": %.6f, \"rows_per_second\": %.0f, \"bytes_per_second\": %.0f }%s\n",
+             phase.name, phase.seconds, phase.rows / phase.seconds, phase.bytes / phase.seconds,
+             i + 1 < phase_count ? "," : "");
+    }
+
+  printf("  }\n}\n");
+
+  if (show_stats)
+    stats_report(stderr);
+}
@@ -1,20 +1,99 @@
 #define MAX_CATEGORIES_FOR_INTEGERS 7
 #define BINS_COUNT 4
+// Bins of a column are counted in histograms of every node, so there can't be too many of them.
+#define MAX_BINS_COUNT (1 << 16)
+#define QUANTILE_MIN_ROWS_PER_THREAD (1 << 16)
 
 using CategoryId = size_t;
 
 constexpr CategoryId INVALID_CATEGORY_ID = std::numeric_limits<CategoryId>::max();
 
+#define BINNING_VECTOR_MAX_EDGES 16
+#define BINNING_BUFFER_SIZE 256
+
 struct SubdividedInterval
 {
+  // 'count + 1' non decreasing edges of bins. Equal width bins are computed by repeatedly adding 'step' to 'min',
+  // other bins have 'step' set to zero and can be of any width.
+  FlatArray<f64> edges;
   f64 min, step;
   size_t count;
+  bool is_uniform;
+
+  // Bin 'i' has values in [edges[i], edges[i + 1]). Last bin also takes 'edges[count]' and, as it always did, values below 'min'.
+  CategoryId find(f64 value)
+  {
+    // Also catches NaN.
+    if (!(value <= edges[count]))
+      return INVALID_CATEGORY_ID;
+    if (value < edges[0])
+      return count - 1;
+
+    if (!is_uniform)
+      return std::upper_bound(edges.begin() + 1, edges.begin() + count, value) - (edges.begin() + 1);
+
+    // Guess is off by at most one because of rounding, fix it up against edges.
+    size_t i = step > 0 ? std::min(size_t((value - min) / step), count - 1) : count - 1;
+    while (i > 0 && edges[i] > value)
+      --i;
+    while (i + 1 < count && edges[i + 1] <= value)
+      ++i;
+
+    return i;
+  }
+
+  // Same as 'find' for every value. Index of the bin is the number of inner edges not greater than the value,
+  // which can be computed without branches.
+  void find_all(const f64 *values, size_t value_count, CategoryId *result)
+  {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    if (count <= BINNING_VECTOR_MAX_EDGES)
+      {
+        auto first_edge = _mm256_set1_pd(edges[0]);
+        auto last_edge = _mm256_set1_pd(edges[count]);
+        auto last_bin = _mm256_set1_epi64x(count - 1);
+        auto invalid = _mm256_set1_epi64x(INVALID_CATEGORY_ID);
+
+        for (; i + 4 <= value_count; i += 4)
+          {
+            auto value = _mm256_loadu_pd(values + i);
+            auto bin = _mm256_setzero_si256();
+
+            for (size_t k = 1; k < count; k++)
+              {
+                auto is_above = _mm256_castpd_si256(_mm256_cmp_pd(value, _mm256_set1_pd(edges[k]), _CMP_GE_OQ));
+                bin = _mm256_sub_epi64(bin, is_above);
+              }
+
+            auto is_below = _mm256_castpd_si256(_mm256_cmp_pd(value, first_edge, _CMP_LT_OQ));
+            auto is_valid = _mm256_castpd_si256(_mm256_cmp_pd(value, last_edge, _CMP_LE_OQ));
+            bin = _mm256_blendv_epi8(bin, last_bin, is_below);
+            bin = _mm256_blendv_epi8(invalid, bin, is_valid);
+            _mm256_storeu_si256((__m256i *)(result + i), bin);
+          }
+      }
+#endif
+
+    for (; i < value_count; i++)
+      result[i] = find(values[i]);
+  }
 };
 
 struct CategoryOfIntegers
 {
-  std::map<i64, CategoryId> to;
-  std::vector<i64> from;
+  // There are at most 'MAX_CATEGORIES_FOR_INTEGERS' values, linear search is faster than anything else.
+  FlatArray<i64> from;
+
+  CategoryId find(i64 value)
+  {
+    for (size_t i = 0; i < from.size(); i++)
+      if (from[i] == value)
+        return i;
+
+    return INVALID_CATEGORY_ID;
+  }
 };
 
 struct CategoryOfDecimals
@@ -24,8 +103,8 @@ struct CategoryOfDecimals
 
 struct CategoryOfStrings
 {
-  std::map<std::string, CategoryId> to;
-  std::vector<std::string_view> from;
+  // Id of string in the dictionary is its category. Strings are copied, so they don't depend on the table.
+  StringDictionary to;
 };
 
 union CategoryData
@@ -112,7 +191,7 @@ struct Category
     switch (type)
       {
       case Category_Of_Integers:
-        return as.integers.to.size();
+        return as.integers.from.size();
       case Category_Of_Decimals:
         return as.decimals.interval.count;
       case Category_Of_Strings:
@@ -123,7 +202,7 @@ struct Category
   }
 
   // Returns sentinel value if couldn't convert to category.
-  CategoryId to_category(TableCell &cell)
+  CategoryId to_category(const TableCell &cell)
   {
     switch (type)
       {
@@ -132,14 +211,7 @@ struct Category
           if (cell.type != Table_Cell_Integer)
             return INVALID_CATEGORY_ID;
 
-          auto it = as.integers.to.find(cell.as.integer);
-
-          if (it == as.integers.to.end())
-            return INVALID_CATEGORY_ID;
-
-          auto &[_, id] = *it;
-
-          return id;
+          return as.integers.find(cell.as.integer);
         }
 
         break;
@@ -160,21 +232,7 @@ struct Category
               break;
             }
 
-          auto interval = as.decimals.interval;
-          auto curr = interval.min, next = curr + interval.step;
-          // Could binary search here.
-          CategoryId i = 0;
-          for (; i + 1 < interval.count; i++)
-            {
-              if (curr <= value && value < next)
-                return i;
-
-              curr = next;
-              next += interval.step;
-            }
-
-          // Should use epsilon?
-          return value <= next ? i : INVALID_CATEGORY_ID;
+          return as.decimals.interval.find(value);
         }
 
         break;
@@ -183,14 +241,9 @@ struct Category
           if (cell.type != Table_Cell_String)
             return INVALID_CATEGORY_ID;
 
-          auto it = as.strings.to.find(std::string{ cell.as.string });
-
-          if (it == as.strings.to.end())
-            return INVALID_CATEGORY_ID;
+          auto id = as.strings.to.find(cell.as.string);
 
-          auto &[_, id] = *it;
-
-          return id;
+          return id == INVALID_STRING_ID ? INVALID_CATEGORY_ID : id;
         }
 
         break;
@@ -199,13 +252,79 @@ struct Category
     UNREACHABLE();
   }
 
-  CategoryId to_category_no_fail(TableCell &cell)
+  CategoryId to_category_no_fail(const TableCell &cell)
   {
     auto result = to_category(cell);
     assert(result != INVALID_CATEGORY_ID);
     return result;
   }
 
+  // Converts cells of a column to categories, 'result' must have room for 'end_row - start_row' ids.
+  void to_categories(Table &table, size_t col, size_t start_row, size_t end_row, CategoryId *result)
+  {
+    auto &column = table.columns[col];
+    auto values = column.values.data();
+
+    if (column.is_mixed())
+      {
+        for (size_t row = start_row; row < end_row; row++)
+          *result++ = to_category(table.grab(row, col));
+
+        return;
+      }
+
+    switch (type)
+      {
+      case Category_Of_Integers:
+        if (column.type != Table_Cell_Integer)
+          std::fill(result, result + (end_row - start_row), INVALID_CATEGORY_ID);
+        else
+          for (size_t row = start_row; row < end_row; row++)
+            *result++ = as.integers.find(values[row].integer);
+
+        break;
+      case Category_Of_Decimals:
+        switch (column.type)
+          {
+          case Table_Cell_Integer:
+            {
+              f64 buffer[BINNING_BUFFER_SIZE];
+
+              for (size_t row = start_row; row < end_row; row += BINNING_BUFFER_SIZE)
+                {
+                  auto count = std::min(size_t(BINNING_BUFFER_SIZE), end_row - row);
+                  for (size_t i = 0; i < count; i++)
+                    buffer[i] = values[row + i].integer;
+
+                  as.decimals.interval.find_all(buffer, count, result + (row - start_row));
+                }
+            }
+
+            break;
+          case Table_Cell_Decimal:
+            static_assert(sizeof(TableValue) == sizeof(f64));
+            as.decimals.interval.find_all(&values[start_row].decimal, end_row - start_row, result);
+            break;
+          case Table_Cell_String:
+            std::fill(result, result + (end_row - start_row), INVALID_CATEGORY_ID);
+            break;
+          }
+
+        break;
+      case Category_Of_Strings:
+        if (column.type != Table_Cell_String)
+          std::fill(result, result + (end_row - start_row), INVALID_CATEGORY_ID);
+        else
+          for (size_t row = start_row; row < end_row; row++)
+            {
+              auto id = as.strings.to.find(table.string_pool[values[row].string]);
+              *result++ = id == INVALID_STRING_ID ? INVALID_CATEGORY_ID : id;
+            }
+
+        break;
+      }
+  }
+
   std::string to_string(CategoryId id)
   {
     switch (type)
@@ -214,19 +333,18 @@ struct Category
         return std::to_string(as.integers.from[id]);
       case Category_Of_Decimals:
         {
-          auto interval = as.decimals.interval;
-          auto curr = interval.min + id * interval.step;
+          auto &interval = as.decimals.interval;
           auto result = std::string{ };
           result.push_back('[');
-          result.append(std::to_string(curr));
+          result.append(std::to_string(interval.edges[id]));
           result.push_back(',');
-          result.append(std::to_string(curr + interval.step));
+          result.append(std::to_string(interval.edges[id + 1]));
           result.push_back(']');
 
           return result;
         }
       case Category_Of_Strings:
-        return std::string{ as.strings.from[id] };
+        return std::string{ as.strings.to[id] };
       }
 
     UNREACHABLE();
@@ -253,8 +371,15 @@ struct Categories
           {
           case Category_Of_Integers:
             {
-              for (auto &[value, id]: category.as.integers.to)
-                std::cout << "    " << value << " --> " << id << '\n';
+              auto &from = category.as.integers.from;
+              auto ids = std::vector<CategoryId>{ };
+              for (size_t id = 0; id < from.size(); id++)
+                ids.push_back(id);
+
+              std::sort(ids.begin(), ids.end(), [&from](CategoryId left, CategoryId right) { return from[left] < from[right]; });
+
+              for (auto id: ids)
+                std::cout << "    " << from[id] << " --> " << id << '\n';
 
               size_t i = 0;
               for (auto value: category.as.integers.from)
@@ -264,19 +389,25 @@ struct Categories
             break;
           case Category_Of_Decimals:
             {
-              auto interval = category.as.decimals.interval;
-              std::cout << "    " << '[' << interval.min << ", " << interval.min + interval.count * interval.step << ']' << '\n';
+              auto &interval = category.as.decimals.interval;
+              std::cout << "    " << '[' << interval.edges.front() << ", " << interval.edges.back() << ']' << '\n';
             }
 
             break;
           case Category_Of_Strings:
             {
-              for (auto &[value, id]: category.as.strings.to)
-                std::cout << "    " << value << " --> " << id << '\n';
+              auto &from = category.as.strings.to;
+              auto ids = std::vector<CategoryId>{ };
+              for (size_t id = 0; id < from.size(); id++)
+                ids.push_back(id);
 
-              size_t i = 0;
-              for (auto value: category.as.strings.from)
-                std::cout << "    " << i++ << " --> " << value << '\n';
+              std::sort(ids.begin(), ids.end(), [&from](CategoryId left, CategoryId right) { return from[left] < from[right]; });
+
+              for (auto id: ids)
+                std::cout << "    " << from[id] << " --> " << id << '\n';
+
+              for (size_t id = 0; id < from.size(); id++)
+                std::cout << "    " << id << " --> " << from[id] << '\n';
             }
 
             break;
@@ -305,67 +436,164 @@ bucketize(f64 min, f64 max, size_t count)
   result.min = min;
   result.step = (max - min) / count;
   result.count = count;
+  result.is_uniform = true;
+  result.edges.push_back(min);
+
+  for (size_t i = 0; i < count; i++)
+    result.edges.push_back(result.edges.back() + result.step);
+
+  // Adding up steps can round the last edge below 'max', which would leave the largest values without a bin.
+  result.edges.back() = std::max(result.edges.back(), max);
+
+  return result;
+}
+
+// Every bin gets about the same number of values.
+SubdividedInterval
+bucketize_by_quantiles(QuantileSketch &sketch, size_t count)
+{
+  auto result = SubdividedInterval{};
+  result.min = sketch.min;
+  result.step = 0;
+  result.count = count;
+  result.is_uniform = false;
+  result.edges.push_back(sketch.min);
+
+  for (size_t i = 1; i < count; i++)
+    result.edges.push_back(std::clamp(sketch.quantile(f64(i) / count), result.edges.back(), sketch.max));
+
+  result.edges.push_back(sketch.max);
 
   return result;
 }
 
+enum BinningMode
+  {
+    Binning_Equal_Width,
+    Binning_Quantiles,
+  };
+
+struct CategorizeOptions
+{
+  BinningMode binning = Binning_Equal_Width;
+  size_t bins_count = BINS_COUNT;
+  size_t thread_count = 1;
+};
+
+// Column must be either of integers or of decimals.
+SubdividedInterval
+subdivide_column(TableColumn &column, CategorizeOptions &options)
+{
+  assert(!column.is_mixed() && column.type != Table_Cell_String);
+
+  auto value_at =
+    [&column](size_t row) -> f64
+    {
+      auto value = column.values[row];
+      return column.type == Table_Cell_Integer ? value.integer : value.decimal;
+    };
+
+  switch (options.binning)
+    {
+    case Binning_Equal_Width:
+      {
+        f64 min = DBL_MAX, max = -DBL_MAX;
+
+        for (size_t row = 0; row < column.values.size(); row++)
+          {
+            min = std::min(min, value_at(row));
+            max = std::max(max, value_at(row));
+          }
+
+        return bucketize(min, max, options.bins_count);
+      }
+    case Binning_Quantiles:
+      {
+        auto rows = column.values.size();
+        auto thread_count = std::clamp(rows / QUANTILE_MIN_ROWS_PER_THREAD, size_t(1), std::max(options.thread_count, size_t(1)));
+        auto sketches = std::vector<QuantileSketch>{ };
+        sketches.resize(thread_count);
+
+        parallel_for(thread_count, [&](size_t i)
+        {
+          for (size_t row = rows * i / thread_count; row < rows * (i + 1) / thread_count; row++)
+            sketches[i].add(value_at(row));
+
+          sketches[i].compress();
+        });
+
+        for (size_t i = 1; i < thread_count; i++)
+          sketches[0].merge(sketches[i]);
+
+        return bucketize_by_quantiles(sketches[0], options.bins_count);
+      }
+    }
+
+  UNREACHABLE();
+}
+
 Categories
-categorize(Table &table)
+categorize(Table &table, CategorizeOptions options)
 {
-  assert(table.cols >= 3 && table.rows >= 2);
+  STATS_SCOPE(Stats_Phase_Categorize);
+
+  assert(options.bins_count >= 1);
+
+  // Tables come straight from the training file, so they are checked even in release builds.
+  if (table.cols < 3 || table.header.size() != table.cols)
+    {
+      fprintf(stderr, "error: training file should have a header and at least three columns.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  if (table.rows == 0)
+    {
+      fprintf(stderr, "error: training file has no rows.\n");
+      exit(EXIT_FAILURE);
+    }
 
   auto ct = Categories{ };
   ct.cols = table.cols - 1;
-  ct.rows = table.rows - 1;
+  ct.rows = table.rows;
   ct.data.reserve(ct.cols);
   ct.labels.reserve(ct.cols);
 
   // Extract columns name.
   for (size_t i = 1; i < table.cols; i++)
-    ct.labels.push_back(table.grab(0, i).stringify());
+    ct.labels.push_back(table.header[i]);
 
   for (size_t col = 1; col < table.cols; col++)
     {
-      switch (table.grab(1, col).type)
+      auto &column = table.columns[col];
+
+      if (column.is_mixed())
+        {
+          fprintf(stderr, "error: column '%s' has cells of different types.\n", table.header[col].c_str());
+          exit(EXIT_FAILURE);
+        }
+
+      switch (column.type)
         {
         case Table_Cell_Integer:
           {
-            auto to = std::map<i64, CategoryId>{ };
-            i64 min = INT64_MAX, max = INT64_MIN;
+            auto integers = CategoryOfIntegers{ };
 
-            for (size_t row = 1; row < table.rows; row++)
+            for (auto value: column.values)
               {
-                auto &cell = table.grab(row, col);
-
-                if (cell.type != Table_Cell_Integer)
-                  {
-                    exit(EXIT_FAILURE);
-                  }
-
-                min = std::min(min, cell.as.integer);
-                max = std::max(max, cell.as.integer);
-
-                if (to.size() <= MAX_CATEGORIES_FOR_INTEGERS)
-                  to.emplace(cell.as.integer, to.size());
+                if (integers.from.size() <= MAX_CATEGORIES_FOR_INTEGERS && integers.find(value.integer) == INVALID_CATEGORY_ID)
+                  integers.from.push_back(value.integer);
               }
 
-            if (to.size() > MAX_CATEGORIES_FOR_INTEGERS)
+            if (integers.from.size() > MAX_CATEGORIES_FOR_INTEGERS)
               {
                 auto category = Category{ Category_Of_Decimals };
-                category.as.decimals.interval = bucketize(min, max, BINS_COUNT);
+                category.as.decimals.interval = subdivide_column(column, options);
                 ct.data.push_back(std::move(category));
               }
             else
               {
-                auto from = std::vector<i64>{ };
-                from.resize(to.size());
-
-                for (auto &[key, id]: to)
-                  from[id] = key;
-
                 auto category = Category{ Category_Of_Integers };
-                category.as.integers.to = std::move(to);
-                category.as.integers.from = std::move(from);
+                category.as.integers = std::move(integers);
                 ct.data.push_back(std::move(category));
               }
           }
@@ -373,52 +601,26 @@ categorize(Table &table)
           break;
         case Table_Cell_Decimal:
           {
-            f64 min = DBL_MAX, max = -DBL_MAX;
-
-            for (size_t row = 1; row < table.rows; row++)
-              {
-                auto &cell = table.grab(row, col);
-
-                if (cell.type != Table_Cell_Decimal)
-                  {
-                    exit(EXIT_FAILURE);
-                  }
-
-                min = std::min(min, cell.as.decimal);
-                max = std::max(max, cell.as.decimal);
-              }
-
             auto category = Category{ Category_Of_Decimals };
-            category.as.decimals.interval = bucketize(min, max, BINS_COUNT);
+            category.as.decimals.interval = subdivide_column(column, options);
             ct.data.push_back(std::move(category));
           }
 
           break;
         case Table_Cell_String:
           {
-            auto to = std::map<std::string, CategoryId>{ };
+            auto category = Category{ Category_Of_Strings };
+            // Only look up every distinct string once.
+            auto is_seen = std::vector<bool>{ };
+            is_seen.resize(table.string_pool.size());
 
-            for (size_t row = 1; row < table.rows; row++)
+            for (auto value: column.values)
               {
-                auto &cell = table.grab(row, col);
-
-                if (cell.type != Table_Cell_String)
-                  {
-                    exit(EXIT_FAILURE);
-                  }
-
-                to.emplace(cell.as.string, to.size());
+                if (!is_seen[value.string])
+                  category.as.strings.to.intern(table.string_pool[value.string]);
+                is_seen[value.string] = true;
               }
 
-            auto from = std::vector<std::string_view>{ };
-            from.resize(to.size());
-
-            for (auto &[key, id]: to)
-              from[id] = key;
-
-            auto category = Category{ Category_Of_Strings };
-            category.as.strings.to = std::move(to);
-            category.as.strings.from = std::move(from);
             ct.data.push_back(std::move(category));
           }
 
@@ -0,0 +1,380 @@
+// Exports a trained tree as a self contained C++ header, so the model is compiled straight into whatever uses it.
+// Splits become nested switches, bins become branch free comparisons against constexpr edges and strings are looked up
+// in constexpr perfect hash tables. Generated code gives the same categories as 'DecisionTree::classify'.
+
+#define CODEGEN_SEED_MULTIPLIER 0x9e3779b97f4a7c15ull
+// Average count of strings per bucket of the perfect hash.
+#define CODEGEN_BUCKET_SIZE 4
+#define CODEGEN_MAX_SEED (1u << 24)
+// Smaller dictionaries are searched linearly, that is faster than hashing.
+#define CODEGEN_LINEAR_SEARCH_MAX_STRINGS 8
+
+// Strings are hashed once with 'hash_string', which is emitted into the generated header, and the hash is mixed with
+// a seed to find the slot. Generated header does the same.
+size_t
+codegen_slot(uint64_t hash, uint64_t seed, size_t slot_count)
+{
+  return (((hash ^ (seed * CODEGEN_SEED_MULTIPLIER)) * CODEGEN_SEED_MULTIPLIER) >> 32) & (slot_count - 1);
+}
+
+// Hash and displace: strings are split into buckets by their hash, then for every bucket, starting with the largest,
+// a seed is searched for which puts all its strings into free slots.
+struct PerfectHash
+{
+  std::vector<uint32_t> seeds;
+  // String ids, 'INVALID_STRING_ID' for empty slots. Count is a power of two.
+  std::vector<uint32_t> slots;
+
+  void build(StringDictionary &dictionary)
+  {
+    size_t count = dictionary.size();
+    // Leave some slots free, so seeds for the last buckets are found quickly.
+    size_t slot_count = 1;
+    while (slot_count < count + count / 4)
+      slot_count *= 2;
+
+    seeds.assign(std::max(count / CODEGEN_BUCKET_SIZE, size_t(1)), 0);
+    slots.assign(slot_count, INVALID_STRING_ID);
+
+    auto hashes = std::vector<uint64_t>{ };
+    auto buckets = std::vector<std::vector<uint32_t>>{ };
+    buckets.resize(seeds.size());
+    for (uint32_t id = 0; id < count; id++)
+      {
+        hashes.push_back(hash_string(dictionary[id]));
+        buckets[hashes[id] % seeds.size()].push_back(id);
+      }
+
+    auto order = std::vector<size_t>{ };
+    for (size_t i = 0; i < buckets.size(); i++)
+      order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t left, size_t right) { return buckets[left].size() > buckets[right].size(); });
+
+    auto taken = std::vector<size_t>{ };
+
+    for (auto bucket: order)
+      {
+        if (buckets[bucket].empty())
+          break;
+
+        for (uint64_t seed = 1; ; seed++)
+          {
+            // Only happens if two strings have the same hash.
+            if (seed == CODEGEN_MAX_SEED)
+              {
+                fprintf(stderr, "error: couldn't build perfect hash for strings.\n");
+                exit(EXIT_FAILURE);
+              }
+
+            taken.clear();
+
+            for (auto id: buckets[bucket])
+              {
+                auto slot = codegen_slot(hashes[id], seed, slot_count);
+                if (slots[slot] != INVALID_STRING_ID || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                  break;
+                taken.push_back(slot);
+              }
+
+            if (taken.size() == buckets[bucket].size())
+              {
+                for (size_t i = 0; i < taken.size(); i++)
+                  slots[taken[i]] = buckets[bucket][i];
+
+                seeds[bucket] = seed;
+                break;
+              }
+          }
+      }
+  }
+};
+
+// Keywords and alternative tokens of C++20, which can't be used as names.
+const char *CODEGEN_KEYWORDS[] = {
+  "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+  "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+  "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+  "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+  "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+  "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed",
+  "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+  "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+  "wchar_t", "while", "xor", "xor_eq",
+};
+
+// Makes a C++ identifier out of anything. Keywords get '_' appended.
+std::string
+codegen_identifier(std::string_view name)
+{
+  auto result = std::string{ };
+
+  for (auto c: name)
+    result.push_back(isalnum((unsigned char)c) ? c : '_');
+
+  if (result.empty() || isdigit((unsigned char)result[0]))
+    result.insert(result.begin(), '_');
+
+  for (auto keyword: CODEGEN_KEYWORDS)
+    if (result == keyword)
+      result.push_back('_');
+
+  return result;
+}
+
+// String literal with everything except plain printable characters escaped, octal escapes are always three digits long,
+// so the next character can't become a part of them.
+std::string
+codegen_string_literal(std::string_view string)
+{
+  auto result = std::string{ "std::string_view{ \"" };
+
+  for (auto c: string)
+    {
+      auto byte = (unsigned char)c;
+
+      if (byte >= ' ' && byte < 127 && byte != '"' && byte != '\\')
+        result.push_back(c);
+      else
+        {
+          char escape[5];
+          snprintf(escape, sizeof(escape), "\\%03o", byte);
+          result.append(escape);
+        }
+    }
+
+  result.append("\", ");
+  result.append(std::to_string(string.size()));
+  result.append(" }");
+
+  return result;
+}
+
+// Hexadecimal floating point literal, so edges are exactly the same.
+std::string
+codegen_decimal_literal(f64 value)
+{
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%a", value);
+  return buffer;
+}
+
+std::string
+codegen_integer_literal(i64 value)
+{
+  if (value == std::numeric_limits<i64>::min())
+    return "INT64_MIN";
+
+  return "INT64_C(" + std::to_string(value) + ")";
+}
+
+const char *
+codegen_field_type(Category &category)
+{
+  switch (category.type)
+    {
+    case Category_Of_Integers: return "int64_t";
+    case Category_Of_Decimals: return "double";
+    case Category_Of_Strings:  return "std::string_view";
+    }
+
+  UNREACHABLE();
+}
+
+void
+codegen_category_function(std::ostream &out, Category &category, size_t column)
+{
+  switch (category.type)
+    {
+    case Category_Of_Integers:
+      {
+        out << "inline int32_t\ncategory_of_" << column << "(int64_t value)\n{\n  switch (value)\n    {\n";
+
+        auto &from = category.as.integers.from;
+        for (size_t id = 0; id < from.size(); id++)
+          out << "    case " << codegen_integer_literal(from[id]) << ": return " << id << ";\n";
+
+        out << "    default: return INVALID_CATEGORY;\n    }\n}\n\n";
+      }
+
+      break;
+    case Category_Of_Decimals:
+      {
+        auto &interval = category.as.decimals.interval;
+
+        out << "constexpr double EDGES_" << column << "[] = {";
+        for (size_t i = 0; i < interval.edges.size(); i++)
+          out << (i % 4 == 0 ? "\n  " : " ") << codegen_decimal_literal(interval.edges[i]) << ',';
+        out << "\n};\n\n";
+
+        // Same as 'SubdividedInterval::find'.
+        out << "inline int32_t\ncategory_of_" << column << "(double value)\n{\n"
+            << "  if (!(value <= EDGES_" << column << "[" << interval.count << "]))\n    return INVALID_CATEGORY;\n"
+            << "  if (value < EDGES_" << column << "[0])\n    return " << interval.count - 1 << ";\n\n"
+            << "  int32_t category = 0;\n";
+
+        if (interval.count > 1)
+          out << "  for (int i = 1; i < " << interval.count << "; i++)\n"
+              << "    category += value >= EDGES_" << column << "[i];\n";
+
+        out << "\n  return category;\n}\n\n";
+      }
+
+      break;
+    case Category_Of_Strings:
+      {
+        auto &dictionary = category.as.strings.to;
+
+        if (dictionary.size() <= CODEGEN_LINEAR_SEARCH_MAX_STRINGS)
+          {
+            out << "inline int32_t\ncategory_of_" << column << "(std::string_view value)\n{\n";
+            for (size_t id = 0; id < dictionary.size(); id++)
+              out << "  if (value == " << codegen_string_literal(dictionary[id]) << ")\n    return " << id << ";\n";
+            out << "\n  return INVALID_CATEGORY;\n}\n\n";
+
+            break;
+          }
+
+        auto hash = PerfectHash{ };
+        hash.build(dictionary);
+
+        out << "constexpr std::string_view STRINGS_" << column << "[] = {\n";
+        for (size_t id = 0; id < dictionary.size(); id++)
+          out << "  " << codegen_string_literal(dictionary[id]) << ",\n";
+        out << "};\n\n";
+
+        out << "constexpr uint32_t SEEDS_" << column << "[] = {";
+        for (size_t i = 0; i < hash.seeds.size(); i++)
+          out << (i % 8 == 0 ? "\n  " : " ") << hash.seeds[i] << ',';
+        out << "\n};\n\n";
+
+        out << "constexpr uint32_t SLOTS_" << column << "[] = {";
+        for (size_t i = 0; i < hash.slots.size(); i++)
+          out << (i % 8 == 0 ? "\n  " : " ") << hash.slots[i] << "u,";
+        out << "\n};\n\n";
+
+        out << "inline int32_t\ncategory_of_" << column << "(std::string_view value)\n{\n"
+            << "  auto hash = hash_string(value);\n"
+            << "  uint64_t seed = SEEDS_" << column << "[hash % " << hash.seeds.size() << "];\n"
+            << "  auto id = SLOTS_" << column << "[(((hash ^ (seed * SEED_MULTIPLIER)) * SEED_MULTIPLIER) >> 32) & "
+            << hash.slots.size() - 1 << "];\n\n"
+            << "  if (id == EMPTY_SLOT || STRINGS_" << column << "[id] != value)\n    return INVALID_CATEGORY;\n\n"
+            << "  return int32_t(id);\n}\n\n";
+      }
+
+      break;
+    }
+}
+
+void
+codegen_node(std::ostream &out, DecisionTree &tree, std::vector<std::string> &fields, uint32_t index, size_t depth)
+{
+  auto indent = std::string(depth * 4 + 2, ' ');
+  auto &node = tree.nodes[index];
+
+  if (node.column_index == COMPILED_LEAF)
+    {
+      out << indent << "return " << node.payload << ";\n";
+      return;
+    }
+
+  auto category_count = tree.categories->data[node.column_index].category_count();
+
+  out << indent << "switch (category_of_" << node.column_index << "(sample." << fields[node.column_index] << "))\n"
+      << indent << "  {\n";
+
+  for (size_t i = 0; i < category_count; i++)
+    {
+      out << indent << "  case " << i << ":\n";
+      codegen_node(out, tree, fields, node.payload + i, depth + 1);
+    }
+
+  out << indent << "  default:\n"
+      << indent << "    return INVALID_CATEGORY;\n"
+      << indent << "  }\n";
+}
+
+// Writes header with namespace 'name', which has 'Sample' with a field for every column, 'visit_fields(sample, visit)',
+// 'classify(sample)' which returns goal category or 'INVALID_CATEGORY', and 'GOAL_NAMES'.
+void
+export_cpp_header(const char *filepath, const char *name, DecisionTree &tree, Categories &categories)
+{
+  auto out = std::ofstream{ filepath };
+
+  out << "// Generated from a decision tree trained on " << categories.rows << " rows, don't edit.\n\n"
+      << "#pragma once\n\n"
+      << "#include <cstdint>\n"
+      << "#include <cstring>\n"
+      << "#include <string_view>\n\n"
+      << "namespace " << codegen_identifier(name) << "\n{\n\n"
+      << "constexpr int32_t INVALID_CATEGORY = -1;\n"
+      << "constexpr uint32_t EMPTY_SLOT = " << INVALID_STRING_ID << "u;\n\n"
+      << "constexpr uint64_t SEED_MULTIPLIER = " << CODEGEN_SEED_MULTIPLIER << "ull;\n\n"
+      // Same as 'hash_string'.
+      << "inline uint64_t\nhash_string(std::string_view string)\n{\n"
+      << "  constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15;\n"
+      << "  uint64_t hash = string.size() * MULTIPLIER;\n"
+      << "  size_t i = 0;\n\n"
+      << "  for (; i + 8 <= string.size(); i += 8)\n    {\n"
+      << "      uint64_t word;\n"
+      << "      memcpy(&word, string.data() + i, 8);\n"
+      << "      hash = (hash ^ word) * MULTIPLIER;\n"
+      << "      hash ^= hash >> 32;\n    }\n\n"
+      << "  if (i < string.size())\n    {\n"
+      << "      uint64_t word = 0;\n"
+      << "      memcpy(&word, string.data() + i, string.size() - i);\n"
+      << "      hash = (hash ^ word) * MULTIPLIER;\n"
+      << "      hash ^= hash >> 32;\n    }\n\n"
+      << "  return hash;\n}\n\n";
+
+  // Every column but the goal gets a field, even if no node splits on it, so samples are filled the same way.
+  auto fields = std::vector<std::string>{ };
+  fields.resize(categories.cols);
+
+  // Suffixed name can be taken too, by a column that's named like that, so every name is checked against all of them.
+  auto taken = std::set<std::string>{ };
+
+  for (size_t column = 0; column < categories.cols; column++)
+    {
+      auto name = codegen_identifier(categories.labels[column]);
+      fields[column] = name;
+
+      for (size_t suffix = column; !taken.insert(fields[column]).second; suffix++)
+        fields[column] = name + '_' + std::to_string(suffix);
+    }
+
+  for (auto column: tree.split_columns)
+    codegen_category_function(out, categories.data[column], column);
+
+  out << "struct Sample\n{\n";
+  for (size_t column = 0; column < categories.cols; column++)
+    if (column != tree.goal_index)
+      out << "  " << codegen_field_type(categories.data[column]) << ' ' << fields[column] << ";\n";
+  out << "};\n\n";
+
+  // Lets samples be filled from parsed rows without knowing the names of fields.
+  out << "// Calls 'visit(column, field)' for every field of the sample, columns are numbered as in the training file\n"
+      << "// without its first column.\n"
+      << "template<typename Visit>\ninline void\nvisit_fields(Sample &sample, Visit &&visit)\n{\n";
+  for (size_t column = 0; column < categories.cols; column++)
+    if (column != tree.goal_index)
+      out << "  visit(" << column << ", sample." << fields[column] << ");\n";
+  out << "}\n\n";
+
+  auto &goal = categories.data[tree.goal_index];
+  out << "constexpr std::string_view GOAL_NAMES[] = {\n";
+  for (size_t id = 0; id < goal.category_count(); id++)
+    out << "  " << codegen_string_literal(goal.to_string(id)) << ",\n";
+  out << "};\n\n";
+
+  out << "inline int32_t\nclassify(const Sample &sample)\n{\n";
+  codegen_node(out, tree, fields, 0, 0);
+  out << "}\n\n} // namespace " << codegen_identifier(name) << '\n';
+
+  out.close();
+
+  if (!out)
+    {
+      fprintf(stderr, "error: couldn't write '%s'.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+}
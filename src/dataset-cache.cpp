@@ -0,0 +1,150 @@
+// Dataset cache holds categories of a CSV file and all its columns already converted to categories, so training on the
+// same file again skips parsing and categorizing. It is laid out like a model file, and encoded columns are used
+// straight from the mapped cache. Cache is rebuilt when the file or binning options change, or when it is corrupted.
+
+#define DATASET_CACHE_VERSION 1
+
+constexpr char DATASET_CACHE_MAGIC[8] = { 'D', 'T', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+struct DatasetCacheHeader
+{
+  BinaryFileHeader file;
+  // Source file and options which the cache was built from.
+  uint64_t source_size;
+  int64_t source_modified_seconds;
+  int64_t source_modified_nanoseconds;
+  uint64_t binning;
+  uint64_t bins_count;
+  uint64_t rows;
+  // Array of 'ModelColumn'.
+  ModelArray columns;
+  // Array of 'ModelArray', one with category ids of every column.
+  ModelArray encoded;
+};
+
+static_assert(sizeof(DatasetCacheHeader) % MODEL_ALIGNMENT == 0);
+
+bool
+is_same_dataset(DatasetCacheHeader &left, DatasetCacheHeader &right)
+{
+  return left.source_size == right.source_size
+    && left.source_modified_seconds == right.source_modified_seconds
+    && left.source_modified_nanoseconds == right.source_modified_nanoseconds
+    && left.binning == right.binning
+    && left.bins_count == right.bins_count;
+}
+
+// Header which a cache of the CSV file at 'filepath' should have to be up to date.
+DatasetCacheHeader
+expected_dataset_cache_header(const char *filepath, CategorizeOptions &options)
+{
+  struct stat stats;
+  if (stat(filepath, &stats) == -1)
+    {
+      fprintf(stderr, "error: couldn't open '%s'.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+
+  auto expected = DatasetCacheHeader{ };
+  expected.source_size = stats.st_size;
+  expected.source_modified_seconds = stats.st_mtim.tv_sec;
+  expected.source_modified_nanoseconds = stats.st_mtim.tv_nsec;
+  expected.binning = options.binning;
+  expected.bins_count = options.bins_count;
+
+  return expected;
+}
+
+// Maps cache into 'cache' and borrows categories and columns from it, returns false if cache is missing, out of date
+// or corrupted. Cache can always be built again, so a corrupted one is treated like an old one.
+bool
+try_load_dataset_cache(const char *cache_path, DatasetCacheHeader &expected, MappedFile &cache, Categories &categories, std::vector<EncodedColumn> &columns)
+{
+  auto header_array = ModelArray{ };
+  header_array.size = 1;
+
+  if (!try_map_binary_file(cache_path, DATASET_CACHE_MAGIC, DATASET_CACHE_VERSION, cache) || !cache.contains<DatasetCacheHeader>(header_array))
+    return false;
+
+  auto &header = cache.header<DatasetCacheHeader>();
+  if (!is_same_dataset(header, expected) || header.rows == 0)
+    return false;
+
+  if (!try_load_categories(cache, header.columns, header.rows, categories) || categories.cols < 2
+      || !cache.contains<ModelArray>(header.encoded) || header.encoded.size != categories.cols)
+    return false;
+
+  auto encoded = cache.grab<ModelArray>(header.encoded);
+
+  columns.resize(categories.cols);
+
+  for (size_t col = 0; col < categories.cols; col++)
+    {
+      auto &column = columns[col];
+      column.width = EncodedColumn::width_for(categories.data[col].category_count());
+
+      if (encoded[col].size % column.width != 0 || encoded[col].size / column.width != categories.rows || !cache.try_borrow(encoded[col], column.bytes))
+        return false;
+
+      // Builders index histograms with category ids, this is one pass over data they go over many times.
+      auto is_valid = true;
+      column.visit([&](auto *values)
+      {
+        auto category_count = categories.data[col].category_count();
+        is_valid = *std::max_element(values, values + categories.rows) < category_count;
+      });
+
+      if (!is_valid)
+        return false;
+    }
+
+  return true;
+}
+
+// Returns encoded columns of the CSV file at 'filepath'. They are taken from the cache if it is up to date, otherwise
+// file is parsed and categorized, and the cache is written for the next time. Cache stays mapped in 'cache', and
+// categories and columns borrow its memory. Table isn't printed, so output is the same whether the cache is used or not.
+std::vector<EncodedColumn>
+load_or_prepare_dataset(const char *filepath, const char *cache_path, CategorizeOptions &options, MappedFile &cache, Categories &categories)
+{
+  auto expected = expected_dataset_cache_header(filepath, options);
+  auto columns = std::vector<EncodedColumn>{ };
+
+  if (try_load_dataset_cache(cache_path, expected, cache, categories, columns))
+    return columns;
+
+  cache = MappedFile{ };
+
+  auto table = parse_csv_from_file(filepath);
+  if (table.rows == 0)
+    {
+      fprintf(stderr, "error: '%s' has no rows.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+
+  categories = categorize(table, options);
+  columns = encode_columns(table, categories);
+
+  auto writer = ModelWriter{ };
+  auto header = expected;
+  writer.reserve<DatasetCacheHeader>(1);
+
+  header.rows = categories.rows;
+  header.columns = write_categories(writer, categories);
+
+  {
+    auto encoded = std::vector<ModelArray>{ };
+    encoded.resize(columns.size());
+    header.encoded.offset = writer.reserve<ModelArray>(encoded.size());
+    header.encoded.size = encoded.size();
+
+    for (size_t col = 0; col < columns.size(); col++)
+      encoded[col] = writer.append(columns[col].bytes);
+
+    memcpy(writer.buffer.data() + header.encoded.offset, encoded.data(), encoded.size() * sizeof(ModelArray));
+  }
+
+  writer.save(cache_path, header, DATASET_CACHE_MAGIC, DATASET_CACHE_VERSION);
+
+  return columns;
+}
@@ -1,29 +1,53 @@
 #define SAMPLE_COUNT_THRESHOLD 3
+#define PARALLEL_BUILD_MIN_SAMPLES 4096
+#define PARALLEL_SPLIT_MIN_SAMPLES (1 << 16)
+#define MAX_FUSED_COLUMNS 8
+#define ENCODE_BATCH_SIZE 4096
+#define N_LOG2_N_TABLE_SIZE (1 << 16)
+#define CLASSIFY_BATCH_SIZE 4096
+#define CLASSIFY_GROUP_SIZE 16
 
 constexpr size_t INVALID_COLUMN_INDEX = (size_t)-1;
 
+// Nodes live in arenas of their tree, so it is freed all at once and not node by node.
 struct DecisionTreeNode
 {
-  std::vector<DecisionTreeNode> children;
+  // One child for every category of the column, none for leaves.
+  DecisionTreeNode *children;
+  size_t child_count;
   size_t column_index;
   CategoryId category;
   size_t sample_count;
+  // Leaf which got no rows, it has category and sample count of its parent.
+  bool is_empty;
 
   void print(Categories &categories, size_t offset)
   {
     for (size_t i = offset; i-- > 0; )
       std::cout << ' ';
 
-    if (!children.empty())
+    if (child_count != 0)
       std::cout << "<" << categories.labels[column_index] << " " << sample_count << ">\n";
     else
       std::cout << "'" << categories.data[column_index].to_string(category) << "' " << sample_count << '\n';
 
-    for (auto &child: children)
-      child.print(categories, offset + 4);
+    for (size_t i = 0; i < child_count; i++)
+      children[i].print(categories, offset + 4);
   }
 };
 
+constexpr uint32_t COMPILED_LEAF = std::numeric_limits<uint32_t>::max();
+
+// Node of the tree laid out for classification. Nodes are stored in breadth first order in one array,
+// so children of a node are next to each other.
+struct CompiledTreeNode
+{
+  // Column to split on, 'COMPILED_LEAF' for leaves.
+  uint32_t column_index;
+  // Index of the first child, or goal category for leaves.
+  uint32_t payload;
+};
+
 struct DecisionTree
 {
   struct ClassifyResult
@@ -32,41 +56,148 @@ struct DecisionTree
     bool is_ok;
   };
 
-  std::unique_ptr<DecisionTreeNode> root;
+  // Null if tree was loaded from a model file, then only compiled nodes are available.
+  DecisionTreeNode *root = nullptr;
+  // Memory of all nodes, one arena for every worker that built the tree.
+  std::vector<Arena> arenas;
+  FlatArray<CompiledTreeNode> nodes;
+  // Columns which are used by some node, in increasing order.
+  FlatArray<uint32_t> split_columns;
   Categories *categories;
   size_t goal_index;
 
-  CategoryId classify(TableCell *data, size_t count)
+  // Lays the tree out into 'nodes', should be called after the tree has been built or updated.
+  void compile()
   {
-    // Account for goal column.
-    assert(count + 1 >= categories->cols);
-
-    auto node = root.get();
+    auto queue = std::vector<DecisionTreeNode *>{ };
+    queue.push_back(root);
+    nodes.resize(1);
+    split_columns.resize(0);
 
-    do
+    for (size_t i = 0; i < queue.size(); i++)
       {
-        if (node->children.empty())
-          return node->category;
+        auto node = queue[i];
+
+        if (node->child_count == 0)
+          {
+            assert(node->category < COMPILED_LEAF);
+            nodes[i].column_index = COMPILED_LEAF;
+            nodes[i].payload = node->category;
+          }
         else
           {
-            assert(node->column_index < count);
-            auto column = node->column_index;
-            auto category = categories->data[column].to_category(data[column]);
+            assert(node->column_index < COMPILED_LEAF && nodes.size() + node->child_count < COMPILED_LEAF);
+            nodes[i].column_index = node->column_index;
+            nodes[i].payload = nodes.size();
+
+            for (size_t child = 0; child < node->child_count; child++)
+              queue.push_back(&node->children[child]);
+
+            nodes.resize(queue.size());
+            split_columns.push_back(node->column_index);
+          }
+      }
+
+    std::sort(split_columns.begin(), split_columns.end());
+    split_columns.resize(std::unique(split_columns.begin(), split_columns.end()) - split_columns.begin());
+  }
+
+  CategoryId classify(Table &samples, size_t row)
+  {
+    // Account for goal column.
+    assert(samples.cols + 1 >= categories->cols);
+    assert(!nodes.empty());
+
+    auto node = nodes[0];
+
+    while (node.column_index != COMPILED_LEAF)
+      {
+        assert(node.column_index < samples.cols);
+        auto column = node.column_index;
+        auto category = categories->data[column].to_category(samples.grab(row, column));
+
+        if (category == INVALID_CATEGORY_ID)
+          return INVALID_CATEGORY_ID;
 
-            if (category == INVALID_CATEGORY_ID)
-              return INVALID_CATEGORY_ID;
+        node = nodes[node.payload + category];
+      }
+
+    return node.payload;
+  }
+
+  // Classifies 'count' rows which are already converted to categories, 'encoded' has categories of every split column,
+  // one column per row. Groups of rows go down the tree together, so loads of nodes for different rows overlap.
+  void classify_encoded(Flattened2DArray<CategoryId> &encoded, size_t count, CategoryId *result)
+  {
+    for (size_t group = 0; group < count; group += CLASSIFY_GROUP_SIZE)
+      {
+        auto group_size = std::min(size_t(CLASSIFY_GROUP_SIZE), count - group);
+        uint32_t cursors[CLASSIFY_GROUP_SIZE] = { };
+        size_t active = group_size;
 
-            node = &node->children[category];
+        while (active > 0)
+          {
+            active = 0;
+
+            for (size_t i = 0; i < group_size; i++)
+              {
+                // Rows which couldn't be classified have cursor set to 'COMPILED_LEAF'.
+                if (cursors[i] == COMPILED_LEAF)
+                  continue;
+
+                auto &node = nodes[cursors[i]];
+                if (node.column_index == COMPILED_LEAF)
+                  continue;
+
+                auto category = encoded.grab(node.column_index, group + i);
+                if (category == INVALID_CATEGORY_ID)
+                  {
+                    result[group + i] = INVALID_CATEGORY_ID;
+                    cursors[i] = COMPILED_LEAF;
+                    continue;
+                  }
+
+                cursors[i] = node.payload + category;
+                __builtin_prefetch(&nodes[cursors[i]]);
+                ++active;
+              }
           }
+
+        for (size_t i = 0; i < group_size; i++)
+          if (cursors[i] != COMPILED_LEAF)
+            result[group + i] = nodes[cursors[i]].payload;
       }
-    while (true);
+  }
+
+  // Classifies rows in [start_row, end_row) of samples into 'result'. Columns are converted to categories one at a time,
+  // and then rows are classified by 'classify_encoded'.
+  void classify_batch(Table &samples, size_t start_row, size_t end_row, CategoryId *result)
+  {
+    assert(samples.cols + 1 >= categories->cols);
+    assert(!nodes.empty());
 
-    UNREACHABLE();
+    STATS_SCOPE(Stats_Phase_Classify);
+    STATS_COUNT(Stats_Counter_Rows_Classified, end_row - start_row);
+
+    // Table is in column major order, so 'rows' and 'cols' are swapped.
+    auto encoded = Flattened2DArray<CategoryId>{ };
+    encoded.resize(samples.cols, std::min(size_t(CLASSIFY_BATCH_SIZE), end_row - start_row));
+
+    for (; start_row < end_row; start_row += encoded.cols)
+      {
+        auto count = std::min(encoded.cols, end_row - start_row);
+
+        for (auto column: split_columns)
+          categories->data[column].to_categories(samples, column, start_row, start_row + count, &encoded.grab(column, 0));
+
+        classify_encoded(encoded, count, result);
+        result += count;
+      }
   }
 
-  ClassifyResult classify_as_string(TableCell *data, size_t count)
+  ClassifyResult classify_as_string(Table &samples, size_t row)
   {
-    auto category = classify(data, count);
+    auto category = classify(samples, row);
     auto result = ClassifyResult{ };
     result.is_ok = true;
 
@@ -83,93 +214,227 @@ struct DecisionTree
 
   void print()
   {
+    assert(root);
     root->print(*categories, 0);
   }
 };
 
-// Data needed to build decision tree.
-struct DecisionTreeBuildData
+using RowIndex = uint32_t;
+
+// Category ids of a column, stored in the narrowest type that can hold all of them.
+struct EncodedColumn
 {
-  Flattened2DArray<CategoryId> table;
-  Flattened2DArray<size_t> samples_matrix;
+  FlatArray<uint8_t> bytes;
+  size_t width;
+
+  static size_t width_for(size_t category_count)
+  {
+    if (category_count <= UINT8_MAX + 1)
+      return sizeof(uint8_t);
+    if (category_count <= UINT16_MAX + 1)
+      return sizeof(uint16_t);
+    return sizeof(uint32_t);
+  }
+
+  void resize(size_t rows, size_t category_count)
+  {
+    width = width_for(category_count);
+    bytes.resize(rows * width);
+  }
+
+  template<typename T>
+  T *values()
+  {
+    assert(sizeof(T) == width);
+    return (T *)bytes.data();
+  }
+
+  // Calls 'function' with pointer to values of the right type.
+  template<typename Function>
+  void visit(Function &&function)
+  {
+    switch (width)
+      {
+      case sizeof(uint8_t):  function(values<uint8_t>()); break;
+      case sizeof(uint16_t): function(values<uint16_t>()); break;
+      case sizeof(uint32_t): function(values<uint32_t>()); break;
+      default:               UNREACHABLE();
+      }
+  }
+};
+
+// Buffers for counting samples. Node only needs them until it spawns its children, so tasks that run on the same worker
+// while node waits for its children can reuse them.
+struct DecisionTreeBuildScratch
+{
+  // Samples counted by category and goal category, for every column at 'DecisionTreeBuildData::histogram_offsets'.
+  std::vector<size_t> histogram;
   std::vector<size_t> front_samples_count;
   std::vector<size_t> back_samples_count;
+  // Bounds of rows of children, by depth of the node. Node needs them while it builds its children serially, and
+  // then they are built at the next depth.
+  Flattened2DArray<RowIndex *> offsets;
+};
 
-  std::vector<bool> used_columns;
-  std::vector<size_t> row_indices;
+// Data needed to build decision tree, shared by all workers.
+struct DecisionTreeBuildData
+{
+  // One for every category.
+  EncodedColumn *columns;
+  std::vector<RowIndex> row_indices;
+  // Temporary storage for partitioning row indices of a node, same size as row_indices.
+  std::vector<RowIndex> partition_buffer;
+  // Where histogram of every column starts, last element is size of the whole histogram.
+  std::vector<size_t> histogram_offsets;
+  // 'n * log2(n)' for small sample counts.
+  std::vector<f64> n_log2_n_table;
   size_t sample_count_threshold;
+  // Null if tree is built serially.
+  ThreadPool *pool;
+  // Scratch buffers of every worker.
+  std::vector<DecisionTreeBuildScratch> scratches;
 };
 
 // Node info and sample range for the node that needs to be processed.
 struct DecisionTreeBuildDataNode
 {
-  DecisionTreeBuildDataNode *parent;
   DecisionTreeNode *to_fill;
-  size_t *start_row, *end_row;
+  RowIndex *start_row, *end_row;
+  // Used for nodes without samples, which take the most common goal category of their parent.
+  CategoryId parent_category;
+  size_t parent_sample_count;
+  size_t depth;
 };
 
-f64
-compute_average_entropy_after_split(DecisionTree &tree, DecisionTreeBuildData &data, size_t column_index, size_t *start_row, size_t *end_row)
+inline f64
+n_log2_n(DecisionTreeBuildData &data, size_t n)
 {
-  {
-    auto new_rows = tree.categories->data[column_index].category_count();
-    auto new_cols = tree.categories->data[tree.goal_index].category_count();
-    data.samples_matrix.resize(new_rows, new_cols);
-    data.front_samples_count.resize(new_rows);
-  }
+  if (n < data.n_log2_n_table.size())
+    return data.n_log2_n_table[n];
+  return n * std::log2((f64)n);
+}
 
-  std::fill(data.samples_matrix.data.begin(), data.samples_matrix.data.end(), 0);
-  std::fill(data.front_samples_count.begin(), data.front_samples_count.end(), 0);
+// Counts samples of all unused columns with values of type 'Column' in one pass over rows.
+template<typename Column, typename Goal>
+void
+count_samples_of_width(DecisionTree &tree, DecisionTreeBuildData &data, std::vector<bool> &used_columns, RowIndex *start_row, RowIndex *end_row, Goal *goal, size_t *histogram)
+{
+  size_t  columns_count = 0;
+  Column *columns[MAX_FUSED_COLUMNS];
+  size_t *histograms[MAX_FUSED_COLUMNS];
 
-  size_t samples_count = end_row - start_row;
+  auto goal_category_count = tree.categories->data[tree.goal_index].category_count();
 
-  for (; start_row < end_row; start_row++)
+  for (size_t i = 0; i < used_columns.size(); i++)
     {
-      auto row = data.table.grab(column_index, *start_row);
-      auto col = data.table.grab(tree.goal_index, *start_row);
+      if (used_columns[i] || data.columns[i].width != sizeof(Column))
+        continue;
+
+      auto column_histogram = histogram + data.histogram_offsets[i];
+      std::fill(column_histogram, histogram + data.histogram_offsets[i + 1], 0);
+
+      columns[columns_count] = data.columns[i].values<Column>();
+      histograms[columns_count] = column_histogram;
+      columns_count++;
 
-      ++data.samples_matrix.grab(row, col);
-      ++data.front_samples_count[row];
+      // Columns are counted in groups, so rows are read only once per group and the arrays stay on the stack.
+      if (columns_count == MAX_FUSED_COLUMNS)
+        {
+          for (auto row = start_row; row < end_row; row++)
+            {
+              auto goal_category = goal[*row];
+              for (size_t j = 0; j < MAX_FUSED_COLUMNS; j++)
+                ++histograms[j][columns[j][*row] * goal_category_count + goal_category];
+            }
+
+          columns_count = 0;
+        }
     }
 
+  if (columns_count != 0)
+    {
+      for (auto row = start_row; row < end_row; row++)
+        {
+          auto goal_category = goal[*row];
+          for (size_t j = 0; j < columns_count; j++)
+            ++histograms[j][columns[j][*row] * goal_category_count + goal_category];
+        }
+    }
+}
+
+// Counts samples of all unused columns, columns of the same width are counted together.
+void
+count_samples(DecisionTree &tree, DecisionTreeBuildData &data, std::vector<bool> &used_columns, RowIndex *start_row, RowIndex *end_row, size_t *histogram)
+{
+  STATS_SCOPE(Stats_Phase_Split_Evaluation);
+  STATS_COUNT(Stats_Counter_Rows_Scanned, end_row - start_row);
+
+  data.columns[tree.goal_index].visit([&](auto *goal)
+  {
+    count_samples_of_width<uint8_t>(tree, data, used_columns, start_row, end_row, goal, histogram);
+    count_samples_of_width<uint16_t>(tree, data, used_columns, start_row, end_row, goal, histogram);
+    count_samples_of_width<uint32_t>(tree, data, used_columns, start_row, end_row, goal, histogram);
+  });
+}
+
+// Samples of the column need to be counted by 'count_samples' first. Also counts samples of every category to
+// 'scratch.front_samples_count'.
+f64
+compute_average_entropy_after_split(DecisionTree &tree, DecisionTreeBuildData &data, DecisionTreeBuildScratch &scratch, size_t *histogram, size_t column_index, size_t samples_count)
+{
+  auto category_count = tree.categories->data[column_index].category_count();
+  auto goal_category_count = tree.categories->data[tree.goal_index].category_count();
+  auto column_histogram = histogram + data.histogram_offsets[column_index];
+
+  scratch.front_samples_count.resize(category_count);
+
+  // Entropy of category weighted by its samples is 'n * log2(n) - sum(n_i * log2(n_i))'. Where 'n' is count of
+  // samples in category and 'n_i' are counts of samples of every goal category in it.
   f64 average_entropy = 0;
 
-  for (size_t row = 0; row < data.samples_matrix.rows; row++)
+  for (size_t category = 0; category < category_count; category++)
     {
-      auto samples_in_category = data.front_samples_count[row];
-      f64  entropy = 0;
+      auto   counts = column_histogram + category * goal_category_count;
+      size_t samples_in_category = 0;
+      f64    entropy = 0;
 
-      // Compute 'entropy * samples_in_category', not just entropy. Since I need to compute weighted average of entropy anyway.
-      for (size_t col = 0; col < data.samples_matrix.cols; col++)
+      for (size_t goal_category = 0; goal_category < goal_category_count; goal_category++)
         {
-          auto samples = data.samples_matrix.grab(row, col);
-          if (samples != 0)
-            entropy += samples * std::log((f64)samples / samples_in_category) / log(2);
+          samples_in_category += counts[goal_category];
+          entropy -= n_log2_n(data, counts[goal_category]);
         }
 
-      average_entropy += entropy / samples_count;
+      entropy += n_log2_n(data, samples_in_category);
+      scratch.front_samples_count[category] = samples_in_category;
+      average_entropy += entropy;
     }
 
-  return -average_entropy;
+  return average_entropy / samples_count;
 }
 
+// Ties go to the smallest category, so result doesn't depend on order of rows.
 CategoryId
-find_best_goal_category(DecisionTree &tree, DecisionTreeBuildData &data, size_t *start_row, size_t *end_row)
+find_best_goal_category(DecisionTree &tree, DecisionTreeBuildData &data, DecisionTreeBuildScratch &scratch, RowIndex *start_row, RowIndex *end_row)
 {
   auto   best_goal_category = INVALID_CATEGORY_ID;
   size_t best_sample_count = 0;
 
   {
     auto count = tree.categories->data[tree.goal_index].category_count();
-    data.front_samples_count.resize(count);
+    scratch.front_samples_count.resize(count);
   }
 
-  std::fill(data.front_samples_count.begin(), data.front_samples_count.end(), 0);
+  std::fill(scratch.front_samples_count.begin(), scratch.front_samples_count.end(), 0);
 
-  for (; start_row < end_row; start_row++)
+  data.columns[tree.goal_index].visit([&](auto *goal)
+  {
+    for (; start_row < end_row; start_row++)
+      ++scratch.front_samples_count[goal[*start_row]];
+  });
+
+  for (size_t category = 0; category < scratch.front_samples_count.size(); category++)
     {
-      auto category = data.table.grab(tree.goal_index, *start_row);
-      auto sample_count = ++data.front_samples_count[category];
+      auto sample_count = scratch.front_samples_count[category];
 
       if (best_sample_count < sample_count)
         {
@@ -184,10 +449,15 @@ find_best_goal_category(DecisionTree &tree, DecisionTreeBuildData &data, size_t
 }
 
 void
-build_decision_tree(DecisionTree &tree, DecisionTreeBuildDataNode &node, DecisionTreeBuildData &data)
+build_decision_tree(DecisionTree &tree, DecisionTreeBuildDataNode &node, DecisionTreeBuildData &data, std::vector<bool> &used_columns)
 {
+  auto worker = data.pool ? data.pool->worker_index() : 0;
+  auto &scratch = data.scratches[worker];
+
+  STATS_COUNT(Stats_Counter_Nodes_Built, 1);
+
   auto all_columns_are_used = true;
-  for (auto is_used: data.used_columns)
+  for (auto is_used: used_columns)
     all_columns_are_used = is_used && all_columns_are_used;
 
   size_t sample_count = node.end_row - node.start_row;
@@ -197,18 +467,16 @@ build_decision_tree(DecisionTree &tree, DecisionTreeBuildDataNode &node, Decisio
       if (sample_count == 0)
         {
           // Root node should have at least one sample.
-          assert(node.parent != nullptr);
-          auto old_start_row = node.parent->start_row;
-          auto old_end_row = node.parent->end_row;
-          auto category = find_best_goal_category(tree, data, old_start_row, old_end_row);
+          assert(node.parent_category != INVALID_CATEGORY_ID);
           node.to_fill->column_index = tree.goal_index;
-          node.to_fill->category = category;
-          node.to_fill->sample_count = old_end_row - old_start_row;
+          node.to_fill->category = node.parent_category;
+          node.to_fill->sample_count = node.parent_sample_count;
+          node.to_fill->is_empty = true;
           return;
         }
       else
         {
-          auto category = find_best_goal_category(tree, data, node.start_row, node.end_row);
+          auto category = find_best_goal_category(tree, data, scratch, node.start_row, node.end_row);
           node.to_fill->column_index = tree.goal_index;
           node.to_fill->category = category;
           node.to_fill->sample_count = sample_count;
@@ -216,19 +484,68 @@ build_decision_tree(DecisionTree &tree, DecisionTreeBuildDataNode &node, Decisio
         }
     }
 
+  if (data.pool && sample_count >= PARALLEL_SPLIT_MIN_SAMPLES)
+    {
+      // Every block of rows is counted by its own task to its own histogram. Counts are integers, so it doesn't
+      // matter in which order they are added up.
+      auto block_count = std::min(data.pool->thread_count(), sample_count / (PARALLEL_SPLIT_MIN_SAMPLES / 2));
+      auto block_size = (sample_count + block_count - 1) / block_count;
+      auto block_histograms = std::vector<std::vector<size_t>>{ };
+      block_histograms.resize(block_count);
+
+      auto group = TaskGroup{ };
+
+      for (size_t i = 0; i < block_count; i++)
+        {
+          auto start_row = node.start_row + i * block_size;
+          auto end_row = std::min(start_row + block_size, node.end_row);
+
+          data.pool->spawn(group, [&tree, &data, &used_columns, &block_histograms, i, start_row, end_row]()
+          {
+            block_histograms[i].resize(data.histogram_offsets.back());
+            count_samples(tree, data, used_columns, start_row, end_row, block_histograms[i].data());
+          });
+        }
+
+      // Tasks could have run on this worker while it was waiting, so scratch is filled only after that.
+      data.pool->wait(group);
+
+      std::fill(scratch.histogram.begin(), scratch.histogram.end(), 0);
+
+      for (auto &block_histogram: block_histograms)
+        {
+          for (size_t i = 0; i < used_columns.size(); i++)
+            {
+              if (used_columns[i])
+                continue;
+
+              for (size_t j = data.histogram_offsets[i]; j < data.histogram_offsets[i + 1]; j++)
+                scratch.histogram[j] += block_histogram[j];
+            }
+        }
+    }
+  else
+    {
+      count_samples(tree, data, used_columns, node.start_row, node.end_row, scratch.histogram.data());
+    }
+
   auto best_column = INVALID_COLUMN_INDEX;
 
   {
+    STATS_SCOPE(Stats_Phase_Split_Evaluation);
+
     f64 best_entropy = DBL_MAX;
 
     for (size_t i = 0; i < tree.categories->data.size(); i++)
       {
-        if (!data.used_columns[i])
+        if (!used_columns[i])
           {
-            auto entropy = compute_average_entropy_after_split(tree, data, i, node.start_row, node.end_row);
+            STATS_COUNT(Stats_Counter_Split_Evaluations, 1);
+
+            auto entropy = compute_average_entropy_after_split(tree, data, scratch, scratch.histogram.data(), i, sample_count);
             if (best_entropy > entropy)
               {
-                std::swap(data.front_samples_count, data.back_samples_count);
+                std::swap(scratch.front_samples_count, scratch.back_samples_count);
                 best_entropy = entropy;
                 best_column = i;
               }
@@ -239,94 +556,229 @@ build_decision_tree(DecisionTree &tree, DecisionTreeBuildDataNode &node, Decisio
   assert(best_column != INVALID_COLUMN_INDEX);
 
   auto category_count = tree.categories->data[best_column].category_count();
-  node.to_fill->children.resize(category_count);
+  node.to_fill->children = tree.arenas[worker].allocate<DecisionTreeNode>(category_count);
+  node.to_fill->child_count = category_count;
   node.to_fill->column_index = best_column;
   node.to_fill->category = INVALID_CATEGORY_ID;
   node.to_fill->sample_count = sample_count;
 
-  std::vector<size_t *> offsets;
-  offsets.resize(category_count + 1);
+  auto offsets = &scratch.offsets.grab(node.depth, 0);
 
+  auto has_empty_child = false;
   offsets[0] = node.start_row;
   for (size_t i = 0; i < category_count; i++)
     {
-      auto samples = data.back_samples_count[i];
+      auto samples = scratch.back_samples_count[i];
       offsets[i + 1] = offsets[i] + samples;
+      has_empty_child = samples == 0 || has_empty_child;
     }
 
-  auto const column_sorting_function =
-    [&data, best_column](size_t left, size_t right) -> bool
+  // Group rows by category of the best column. Bucket sizes are already known, so every row is scattered straight to
+  // its place in the partition buffer and then copied back. Nodes never share rows, so sharing the buffer is fine.
+  {
+    STATS_SCOPE(Stats_Phase_Partition);
+    STATS_COUNT(Stats_Counter_Rows_Partitioned, sample_count);
+
+    auto first_row = node.start_row - data.row_indices.data();
+    auto buffer = data.partition_buffer.data() + first_row;
+    auto &cursors = scratch.front_samples_count;
+    cursors.resize(category_count);
+
+    for (size_t i = 0; i < category_count; i++)
+      cursors[i] = offsets[i] - node.start_row;
+
+    data.columns[best_column].visit([&](auto *values)
     {
-      return data.table.grab(best_column, left) < data.table.grab(best_column, right);
-    };
+      for (auto row = node.start_row; row < node.end_row; row++)
+        buffer[cursors[values[*row]]++] = *row;
+    });
 
-  std::sort(node.start_row, node.end_row, column_sorting_function);
+    std::copy(buffer, buffer + sample_count, node.start_row);
+  }
 
-  data.used_columns[best_column] = true;
+  auto category = INVALID_CATEGORY_ID;
+  if (has_empty_child)
+    category = find_best_goal_category(tree, data, scratch, node.start_row, node.end_row);
 
-  for (size_t i = 0; i < category_count; i++)
+  used_columns[best_column] = true;
+
+  if (data.pool && sample_count >= PARALLEL_BUILD_MIN_SAMPLES)
     {
-      auto subnode = DecisionTreeBuildDataNode{ };
-      subnode.parent = &node;
-      subnode.to_fill = &node.to_fill->children[i];
-      subnode.start_row = offsets[i];
-      subnode.end_row = offsets[i + 1];
-      build_decision_tree(tree, subnode, data);
+      // Every child gets its own copy of used columns.
+      auto group = TaskGroup{ };
+
+      for (size_t i = 0; i < category_count; i++)
+        {
+          auto subnode = DecisionTreeBuildDataNode{ };
+          subnode.to_fill = &node.to_fill->children[i];
+          subnode.start_row = offsets[i];
+          subnode.end_row = offsets[i + 1];
+          subnode.parent_category = category;
+          subnode.parent_sample_count = sample_count;
+          subnode.depth = node.depth + 1;
+
+          data.pool->spawn(group, [&tree, &data, subnode, used_columns]() mutable
+          {
+            build_decision_tree(tree, subnode, data, used_columns);
+          });
+        }
+
+      data.pool->wait(group);
+    }
+  else
+    {
+      for (size_t i = 0; i < category_count; i++)
+        {
+          auto subnode = DecisionTreeBuildDataNode{ };
+          subnode.to_fill = &node.to_fill->children[i];
+          subnode.start_row = offsets[i];
+          subnode.end_row = offsets[i + 1];
+          subnode.parent_category = category;
+          subnode.parent_sample_count = sample_count;
+          subnode.depth = node.depth + 1;
+          build_decision_tree(tree, subnode, data, used_columns);
+        }
     }
 
-  data.used_columns[best_column] = false;
+  used_columns[best_column] = false;
 }
 
+// Converts every column of the table, except the first one, to categories.
+std::vector<EncodedColumn>
+encode_columns(Table &table, Categories &categories)
+{
+  STATS_SCOPE(Stats_Phase_Encode);
+
+  auto columns = std::vector<EncodedColumn>{ };
+  columns.resize(categories.cols);
+
+  for (size_t col = 0; col < categories.cols; col++)
+    {
+      auto &category = categories.data[col];
+      auto &column = columns[col];
+      column.resize(categories.rows, category.category_count());
+
+      column.visit([&](auto *values)
+      {
+        // Encode in batches, so full width category ids never take memory for the whole column.
+        CategoryId batch[ENCODE_BATCH_SIZE];
+
+        for (size_t start = 0; start < categories.rows; start += ENCODE_BATCH_SIZE)
+          {
+            auto end = std::min(start + ENCODE_BATCH_SIZE, categories.rows);
+
+            // Add 1 to ignore first column.
+            category.to_categories(table, col + 1, start, end, batch);
+
+            for (size_t row = start; row < end; row++)
+              {
+                assert(batch[row - start] != INVALID_CATEGORY_ID);
+                values[row] = batch[row - start];
+              }
+          }
+      });
+    }
+
+  return columns;
+}
+
+// Row indices have 32 bits.
+void
+check_row_count(Categories &categories)
+{
+  if (categories.rows > UINT32_MAX)
+    {
+      fprintf(stderr, "error: can't build decision tree from more than %u rows.\n", UINT32_MAX);
+      exit(EXIT_FAILURE);
+    }
+}
+
+// Builds tree on rows in 'row_indices', which can repeat, and splits only on columns that aren't marked in
+// 'used_columns'. Tasks are spawned to 'pool' unless it is null, result doesn't depend on it.
 DecisionTree
-build_decision_tree(Table &table, Categories &categories)
+build_decision_tree(std::vector<EncodedColumn> &columns, Categories &categories, ThreadPool *pool, std::vector<RowIndex> row_indices, std::vector<bool> used_columns)
 {
-  assert(categories.rows >= 1 && categories.cols >= 2);
+  assert(categories.rows >= 1 && categories.cols >= 2 && columns.size() == categories.cols);
+  assert(!row_indices.empty() && used_columns.size() == categories.cols);
 
   size_t max_category_count = 0;
   for (auto &category: categories.data)
     max_category_count = std::max(category.category_count(), max_category_count);
 
   auto tree = DecisionTree{ };
-  tree.root = std::make_unique<DecisionTreeNode>();
   tree.categories = &categories;
   tree.goal_index = categories.cols - 1;
 
   auto categories_in_goal = categories.data[tree.goal_index].category_count();
   auto data = DecisionTreeBuildData{ };
-  // Table is in column major order, so 'rows' and 'cols' are swapped.
-  data.table.resize(categories.cols, categories.rows);
-  data.samples_matrix.data.resize(max_category_count * categories_in_goal);
-  data.front_samples_count.resize(max_category_count);
-  data.back_samples_count.resize(max_category_count);
-
-  data.used_columns.resize(categories.cols);
-  data.row_indices.resize(categories.rows);
+  data.columns = columns.data();
+  data.row_indices = std::move(row_indices);
+  data.partition_buffer.resize(data.row_indices.size());
   data.sample_count_threshold = SAMPLE_COUNT_THRESHOLD;
+  data.pool = pool;
+  data.scratches.resize(pool ? pool->thread_count() : 1);
+  tree.arenas.resize(data.scratches.size());
+  tree.root = tree.arenas[0].allocate<DecisionTreeNode>(1);
 
+  data.histogram_offsets.resize(categories.cols + 1);
   for (size_t col = 0; col < categories.cols; col++)
-    {
-      auto &category = categories.data[col];
+    data.histogram_offsets[col + 1] = data.histogram_offsets[col] + categories.data[col].category_count() * categories_in_goal;
 
-      for (size_t row = 0; row < categories.rows; row++)
-        {
-          // Add 1 to ignore first column and row.
-          auto &cell = table.grab(row + 1, col + 1);
-          data.table.grab(col, row) = category.to_category_no_fail(cell);
-        }
-    }
+  data.n_log2_n_table.resize(std::min(data.row_indices.size() + 1, (size_t)N_LOG2_N_TABLE_SIZE));
+  for (size_t n = 1; n < data.n_log2_n_table.size(); n++)
+    data.n_log2_n_table[n] = n * std::log2((f64)n);
 
-  for (size_t i = 0; i < data.row_indices.size(); i++)
-    data.row_indices[i] = i;
+  for (auto &scratch: data.scratches)
+    {
+      scratch.histogram.resize(data.histogram_offsets.back());
+      scratch.front_samples_count.resize(max_category_count);
+      scratch.back_samples_count.resize(max_category_count);
+      // Every level of the tree splits on another column.
+      scratch.offsets.resize(categories.cols, max_category_count + 1);
+    }
 
-  data.used_columns[tree.goal_index] = true;
+  used_columns[tree.goal_index] = true;
 
   auto node = DecisionTreeBuildDataNode{ };
-  node.parent = nullptr;
-  node.to_fill = tree.root.get();
+  node.to_fill = tree.root;
   node.start_row = &data.row_indices.front();
   node.end_row = &data.row_indices.back() + 1;
+  node.parent_category = INVALID_CATEGORY_ID;
+  node.parent_sample_count = 0;
+  node.depth = 0;
 
-  build_decision_tree(tree, node, data);
+  build_decision_tree(tree, node, data, used_columns);
+  tree.compile();
 
   return tree;
 }
+
+// Builds tree on all rows and columns on 'thread_count' threads, result doesn't depend on it.
+DecisionTree
+build_decision_tree(std::vector<EncodedColumn> &columns, Categories &categories, size_t thread_count)
+{
+  STATS_SCOPE(Stats_Phase_Build);
+
+  check_row_count(categories);
+
+  auto pool = std::unique_ptr<ThreadPool>{ };
+  if (thread_count > 1)
+    pool = std::make_unique<ThreadPool>(thread_count);
+
+  auto row_indices = std::vector<RowIndex>{ };
+  row_indices.resize(categories.rows);
+  for (size_t i = 0; i < row_indices.size(); i++)
+    row_indices[i] = i;
+
+  auto used_columns = std::vector<bool>{ };
+  used_columns.resize(categories.cols);
+
+  return build_decision_tree(columns, categories, pool.get(), std::move(row_indices), std::move(used_columns));
+}
+
+DecisionTree
+build_decision_tree(Table &table, Categories &categories, size_t thread_count)
+{
+  auto columns = encode_columns(table, categories);
+  return build_decision_tree(columns, categories, thread_count);
+}
@@ -0,0 +1,210 @@
+// Random forest: trees are trained on bootstrap samples of rows and random subsets of columns, and then vote on the
+// goal category. All trees share encoded columns of the dataset, only their row indices are their own.
+
+#define MAX_FOREST_TREE_COUNT (1 << 16)
+
+struct ForestOptions
+{
+  size_t tree_count = 0;
+  // Count of random columns every tree can split on, 0 for all of them. Trees split every column only once, so with
+  // few columns they lose more from missing columns than they gain from being different.
+  size_t feature_count = 0;
+  uint64_t seed = 1;
+};
+
+struct DecisionForest
+{
+  std::vector<DecisionTree> trees;
+  // Columns which are used by some tree, in increasing order.
+  std::vector<uint32_t> split_columns;
+  Categories *categories;
+  size_t goal_index;
+
+  // Every tree classifies a batch of rows, then votes for its goal category. Ties go to the smallest category, trees
+  // which couldn't classify the row don't vote.
+  void classify_batch(Table &samples, size_t start_row, size_t end_row, CategoryId *result)
+  {
+    assert(samples.cols + 1 >= categories->cols);
+    assert(!trees.empty());
+
+    STATS_SCOPE(Stats_Phase_Classify);
+    STATS_COUNT(Stats_Counter_Rows_Classified, end_row - start_row);
+
+    auto goal_category_count = categories->data[goal_index].category_count();
+
+    // Table is in column major order, so 'rows' and 'cols' are swapped.
+    auto encoded = Flattened2DArray<CategoryId>{ };
+    encoded.resize(samples.cols, std::min(size_t(CLASSIFY_BATCH_SIZE), end_row - start_row));
+
+    auto votes = Flattened2DArray<uint32_t>{ };
+    votes.resize(encoded.cols, goal_category_count);
+
+    auto tree_result = std::vector<CategoryId>{ };
+    tree_result.resize(encoded.cols);
+
+    for (; start_row < end_row; start_row += encoded.cols)
+      {
+        auto count = std::min(encoded.cols, end_row - start_row);
+
+        for (auto column: split_columns)
+          categories->data[column].to_categories(samples, column, start_row, start_row + count, &encoded.grab(column, 0));
+
+        std::fill(votes.data.begin(), votes.data.end(), 0);
+
+        for (auto &tree: trees)
+          {
+            tree.classify_encoded(encoded, count, tree_result.data());
+
+            for (size_t row = 0; row < count; row++)
+              if (tree_result[row] != INVALID_CATEGORY_ID)
+                ++votes.grab(row, tree_result[row]);
+          }
+
+        for (size_t row = 0; row < count; row++)
+          {
+            auto     best_category = INVALID_CATEGORY_ID;
+            uint32_t best_votes = 0;
+
+            for (size_t category = 0; category < goal_category_count; category++)
+              {
+                if (best_votes < votes.grab(row, category))
+                  {
+                    best_votes = votes.grab(row, category);
+                    best_category = category;
+                  }
+              }
+
+            result[row] = best_category;
+          }
+
+        result += count;
+      }
+  }
+
+  void print()
+  {
+    size_t node_count = 0;
+    for (auto &tree: trees)
+      node_count += tree.nodes.size();
+
+    std::cout << "Forest of " << trees.size() << " trees with " << node_count << " nodes\n";
+  }
+};
+
+// Samples as many rows as there are, with replacement. Indices are in increasing order, so columns are read in order.
+std::vector<RowIndex>
+bootstrap_rows(size_t rows, Random &random)
+{
+  auto counts = std::vector<RowIndex>{ };
+  counts.resize(rows);
+
+  for (size_t i = 0; i < rows; i++)
+    ++counts[random.below(rows)];
+
+  auto result = std::vector<RowIndex>{ };
+  result.reserve(rows);
+
+  for (size_t row = 0; row < rows; row++)
+    result.insert(result.end(), counts[row], row);
+
+  return result;
+}
+
+// Marks all but 'feature_count' random columns as used, the goal column is marked by the builder.
+std::vector<bool>
+choose_features(size_t cols, size_t feature_count, Random &random)
+{
+  auto features = cols - 1;
+  auto order = std::vector<size_t>{ };
+  order.resize(features);
+  for (size_t i = 0; i < features; i++)
+    order[i] = i;
+
+  for (size_t i = 0; i < feature_count; i++)
+    std::swap(order[i], order[i + random.below(features - i)]);
+
+  auto used_columns = std::vector<bool>{ };
+  used_columns.assign(cols, true);
+  for (size_t i = 0; i < feature_count; i++)
+    used_columns[order[i]] = false;
+
+  return used_columns;
+}
+
+// Trains 'options.tree_count' trees on 'thread_count' threads, result doesn't depend on it.
+DecisionForest
+build_decision_forest(std::vector<EncodedColumn> &columns, Categories &categories, ForestOptions &options, size_t thread_count)
+{
+  assert(options.tree_count >= 1 && categories.cols >= 2);
+
+  STATS_SCOPE(Stats_Phase_Build);
+
+  check_row_count(categories);
+
+  auto features = categories.cols - 1;
+  auto feature_count = options.feature_count;
+  if (feature_count == 0 || feature_count > features)
+    feature_count = features;
+
+  auto forest = DecisionForest{ };
+  forest.categories = &categories;
+  forest.goal_index = categories.cols - 1;
+  forest.trees.resize(options.tree_count);
+
+  // Every tree has its own generator, so it doesn't matter in which order trees are built.
+  auto seeds = std::vector<uint64_t>{ };
+  {
+    auto random = Random{ options.seed };
+    for (size_t i = 0; i < options.tree_count; i++)
+      seeds.push_back(random.next());
+  }
+
+  auto build_tree =
+    [&](size_t index, ThreadPool *pool)
+    {
+      auto random = Random{ seeds[index] };
+      auto row_indices = bootstrap_rows(categories.rows, random);
+      auto used_columns = choose_features(categories.cols, feature_count, random);
+      forest.trees[index] = build_decision_tree(columns, categories, pool, std::move(row_indices), std::move(used_columns));
+    };
+
+  if (thread_count > 1)
+    {
+      // Every task takes trees one by one, so only as many trees as there are workers take memory at once. Big nodes of
+      // a tree still spawn their own tasks, which idle workers pick up.
+      auto pool = std::make_unique<ThreadPool>(thread_count);
+      auto next_tree = std::atomic<size_t>{ 0 };
+      auto group = TaskGroup{ };
+
+      for (size_t i = 0; i < std::min(thread_count, options.tree_count); i++)
+        {
+          pool->spawn(group, [&]()
+          {
+            for (size_t index; (index = next_tree++) < options.tree_count; )
+              build_tree(index, pool.get());
+          });
+        }
+
+      pool->wait(group);
+    }
+  else
+    {
+      for (size_t i = 0; i < options.tree_count; i++)
+        build_tree(i, nullptr);
+    }
+
+  {
+    auto is_split_column = std::vector<bool>{ };
+    is_split_column.resize(categories.cols);
+
+    for (auto &tree: forest.trees)
+      for (auto column: tree.split_columns)
+        is_split_column[column] = true;
+
+    for (size_t column = 0; column < categories.cols; column++)
+      if (is_split_column[column])
+        forest.split_columns.push_back(column);
+  }
+
+  return forest;
+}
@@ -0,0 +1,194 @@
+constexpr uint32_t INVALID_STRING_ID = std::numeric_limits<uint32_t>::max();
+
+uint64_t
+hash_string(std::string_view string)
+{
+  constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15;
+  uint64_t hash = string.size() * MULTIPLIER;
+  size_t i = 0;
+
+  for (; i + 8 <= string.size(); i += 8)
+    {
+      uint64_t word;
+      memcpy(&word, string.data() + i, 8);
+      hash = (hash ^ word) * MULTIPLIER;
+      hash ^= hash >> 32;
+    }
+
+  if (i < string.size())
+    {
+      uint64_t word = 0;
+      memcpy(&word, string.data() + i, string.size() - i);
+      hash = (hash ^ word) * MULTIPLIER;
+      hash ^= hash >> 32;
+    }
+
+  return hash;
+}
+
+// Linear probing for the slot which either has the string or is empty. 'string_at(id)' gives string with that id,
+// 'slot_count' is a power of two.
+template<typename StringAt>
+size_t
+find_string_slot(uint32_t *slots, size_t slot_count, uint32_t *hashes, std::string_view string, uint64_t hash, StringAt &&string_at)
+{
+  assert(slot_count != 0);
+  size_t mask = slot_count - 1;
+  size_t index = uint32_t(hash) & mask;
+
+  while (true)
+    {
+      auto id = slots[index];
+      if (id == INVALID_STRING_ID || (hashes[id] == uint32_t(hash) && string_at(id) == string))
+        return index;
+
+      index = (index + 1) & mask;
+    }
+}
+
+// Gives every distinct string an id, in order of first occurrence. Flat open addressing table with linear probing,
+// slots only store ids, strings themselves are stored once in 'strings'.
+struct StringInterner
+{
+  constexpr static uint32_t EMPTY_SLOT = INVALID_STRING_ID;
+
+  std::vector<std::string_view> strings;
+  // Lower bits of hashes of 'strings', so most mismatches are rejected without comparing strings.
+  std::vector<uint32_t> hashes;
+  std::vector<uint32_t> slots;
+
+  size_t size()
+  {
+    return strings.size();
+  }
+
+  std::string_view operator[](uint32_t id)
+  {
+    return strings[id];
+  }
+
+  // Returns index of the slot which either has the string or is empty.
+  size_t find_slot(std::string_view string, uint64_t hash)
+  {
+    return find_string_slot(slots.data(), slots.size(), hashes.data(), string, hash, [this](uint32_t id) { return strings[id]; });
+  }
+
+  uint32_t find(std::string_view string)
+  {
+    if (slots.empty())
+      return INVALID_STRING_ID;
+
+    return slots[find_slot(string, hash_string(string))];
+  }
+
+  void grow()
+  {
+    slots.assign(std::max(slots.size() * 2, size_t(16)), EMPTY_SLOT);
+
+    for (uint32_t id = 0; id < strings.size(); id++)
+      {
+        size_t mask = slots.size() - 1;
+        size_t index = hashes[id] & mask;
+
+        while (slots[index] != EMPTY_SLOT)
+          index = (index + 1) & mask;
+
+        slots[index] = id;
+      }
+  }
+
+  // String must outlive the interner.
+  uint32_t intern(std::string_view string)
+  {
+    // Keep load factor under 1/2.
+    if (2 * (strings.size() + 1) > slots.size())
+      grow();
+
+    auto hash = hash_string(string);
+    auto &slot = slots[find_slot(string, hash)];
+
+    if (slot == EMPTY_SLOT)
+      {
+        assert(strings.size() < EMPTY_SLOT);
+        slot = strings.size();
+        strings.push_back(string);
+        hashes.push_back(uint32_t(hash));
+      }
+
+    return slot;
+  }
+};
+
+// Same as 'StringInterner', but strings are always copied and stored one after another, so the whole dictionary is
+// a few flat arrays which can be saved to a file and mapped back.
+struct StringDictionary
+{
+  constexpr static uint32_t EMPTY_SLOT = INVALID_STRING_ID;
+
+  FlatArray<char> bytes;
+  // String 'id' ends at 'ends[id]' in 'bytes' and starts where the previous one ends.
+  FlatArray<uint64_t> ends;
+  FlatArray<uint32_t> hashes;
+  FlatArray<uint32_t> slots;
+
+  size_t size()
+  {
+    return ends.size();
+  }
+
+  std::string_view operator[](uint32_t id)
+  {
+    auto start = id == 0 ? 0 : ends[id - 1];
+    return { bytes.data() + start, ends[id] - start };
+  }
+
+  size_t find_slot(std::string_view string, uint64_t hash)
+  {
+    return find_string_slot(slots.data(), slots.size(), hashes.data(), string, hash, [this](uint32_t id) { return (*this)[id]; });
+  }
+
+  uint32_t find(std::string_view string)
+  {
+    if (slots.empty())
+      return INVALID_STRING_ID;
+
+    return slots[find_slot(string, hash_string(string))];
+  }
+
+  void grow()
+  {
+    slots.assign(std::max(slots.size() * 2, size_t(16)), EMPTY_SLOT);
+
+    for (uint32_t id = 0; id < size(); id++)
+      {
+        size_t mask = slots.size() - 1;
+        size_t index = hashes[id] & mask;
+
+        while (slots[index] != EMPTY_SLOT)
+          index = (index + 1) & mask;
+
+        slots[index] = id;
+      }
+  }
+
+  uint32_t intern(std::string_view string)
+  {
+    // Keep load factor under 1/2.
+    if (2 * (size() + 1) > slots.size())
+      grow();
+
+    auto hash = hash_string(string);
+    auto &slot = slots[find_slot(string, hash)];
+
+    if (slot == EMPTY_SLOT)
+      {
+        assert(size() < EMPTY_SLOT);
+        slot = size();
+        bytes.append(string.data(), string.size());
+        ends.push_back(bytes.size());
+        hashes.push_back(uint32_t(hash));
+      }
+
+    return slot;
+  }
+};
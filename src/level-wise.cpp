@@ -0,0 +1,624 @@
+// Level wise training: instead of going down one node at a time, the tree is built one level at a time. Every row
+// remembers the node it is in, and every pass over a column counts samples of all nodes of the level at once. Split of
+// a node is chosen from its histogram by exactly the same code as in the recursive builder, so trees are the same.
+//
+// Histograms of a level are kept until the next one is counted, then histogram of the biggest child of a node is its
+// parent's minus the ones of its siblings, and its rows aren't counted at all.
+//
+// Deep levels have many small nodes, and their histograms together don't fit in cache, so once nodes get small their
+// children are built depth first by the recursive builder, which reuses one histogram for every node.
+
+#define LEVEL_WISE_HISTOGRAM_BUDGET (256 << 20)
+#define LEVEL_WISE_MIN_NODE_ROWS (1 << 14)
+
+constexpr uint32_t NO_LEVEL_NODE = std::numeric_limits<uint32_t>::max();
+
+// Nodes of a level, which are split once their samples are counted. Levels can have millions of nodes, so columns
+// used by every node are kept as bits in one array.
+struct DecisionTreeLevel
+{
+  std::vector<DecisionTreeNode *> nodes;
+  std::vector<uint64_t> used_columns;
+  size_t words_per_node;
+
+  uint64_t *used_columns_of(size_t node)
+  {
+    return &used_columns[node * words_per_node];
+  }
+
+  void push_back(DecisionTreeNode *node, uint64_t *used)
+  {
+    nodes.push_back(node);
+    used_columns.insert(used_columns.end(), used, used + words_per_node);
+  }
+
+  void resize(size_t count)
+  {
+    nodes.resize(count);
+    used_columns.resize(count * words_per_node);
+  }
+};
+
+bool
+is_column_used(uint64_t *used_columns, size_t col)
+{
+  return (used_columns[col / 64] >> (col % 64)) & 1;
+}
+
+void
+mark_column_used(uint64_t *used_columns, size_t col)
+{
+  used_columns[col / 64] |= uint64_t(1) << (col % 64);
+}
+
+bool
+are_all_columns_used(uint64_t *used_columns, size_t cols)
+{
+  for (size_t col = 0; col < cols; col++)
+    if (!is_column_used(used_columns, col))
+      return false;
+
+  return true;
+}
+
+// Ties go to the smallest category, like in 'find_best_goal_category'. Counts are 'stride' apart.
+CategoryId
+best_goal_category_of(size_t *counts, size_t count, size_t stride)
+{
+  auto   best_goal_category = INVALID_CATEGORY_ID;
+  size_t best_sample_count = 0;
+
+  for (size_t category = 0; category < count; category++)
+    {
+      if (best_sample_count < counts[category * stride])
+        {
+          best_sample_count = counts[category * stride];
+          best_goal_category = category;
+        }
+    }
+
+  assert(best_goal_category != INVALID_CATEGORY_ID);
+
+  return best_goal_category;
+}
+
+// Fills parts of 'data' that level wise builders share with the recursive one, and makes an empty tree with the root.
+// Histogram of the goal column is counted too, it has counts of goal categories of the node on its diagonal.
+void
+start_level_wise_build(DecisionTree &tree, DecisionTreeBuildData &data, std::vector<EncodedColumn> &columns, Categories &categories)
+{
+  assert(categories.rows >= 1 && categories.cols >= 2 && columns.size() == categories.cols);
+
+  size_t max_category_count = 0;
+  for (auto &category: categories.data)
+    max_category_count = std::max(category.category_count(), max_category_count);
+
+  tree.categories = &categories;
+  tree.goal_index = categories.cols - 1;
+  tree.arenas.resize(1);
+  tree.root = tree.arenas[0].allocate<DecisionTreeNode>(1);
+
+  auto goal_category_count = categories.data[tree.goal_index].category_count();
+  data.columns = columns.data();
+  data.sample_count_threshold = SAMPLE_COUNT_THRESHOLD;
+  data.pool = nullptr;
+  data.scratches.resize(1);
+
+  data.histogram_offsets.resize(categories.cols + 1);
+  for (size_t col = 0; col < categories.cols; col++)
+    data.histogram_offsets[col + 1] = data.histogram_offsets[col] + categories.data[col].category_count() * goal_category_count;
+
+  data.n_log2_n_table.resize(std::min(categories.rows + 1, (size_t)N_LOG2_N_TABLE_SIZE));
+  for (size_t n = 1; n < data.n_log2_n_table.size(); n++)
+    data.n_log2_n_table[n] = n * std::log2((f64)n);
+
+  auto &scratch = data.scratches[0];
+  scratch.front_samples_count.resize(max_category_count);
+  scratch.back_samples_count.resize(max_category_count);
+}
+
+// Splits 'node' on the best column it hasn't used yet, or makes it a leaf, from its counted 'histogram'. Marks the
+// column as used and calls 'add_child(category, child, sample_count, is_leaf)' for every child, leaves are already
+// filled by then. Returns the split column, or 'INVALID_COLUMN_INDEX' for leaves.
+template<typename AddChild>
+size_t
+split_level_node(DecisionTree &tree, DecisionTreeBuildData &data, DecisionTreeNode *node, uint64_t *used_columns, size_t *histogram, AddChild &&add_child)
+{
+  auto &scratch = data.scratches[0];
+  auto cols = tree.categories->cols;
+
+  // Like in the recursive builder, nodes are counted when they are split, and leaves when they are made.
+  STATS_COUNT(Stats_Counter_Nodes_Built, 1);
+  auto goal_category_count = tree.categories->data[tree.goal_index].category_count();
+  auto goal_counts = histogram + data.histogram_offsets[tree.goal_index];
+  auto goal_counts_stride = goal_category_count + 1;
+
+  size_t sample_count = 0;
+  for (size_t category = 0; category < goal_category_count; category++)
+    sample_count += goal_counts[category * goal_counts_stride];
+
+  if (are_all_columns_used(used_columns, cols) || sample_count <= data.sample_count_threshold)
+    {
+      // Only the root can get here, other nodes are known to be leaves before they are counted.
+      node->column_index = tree.goal_index;
+      node->category = best_goal_category_of(goal_counts, goal_category_count, goal_counts_stride);
+      node->sample_count = sample_count;
+      return INVALID_COLUMN_INDEX;
+    }
+
+  auto best_column = INVALID_COLUMN_INDEX;
+
+  {
+    STATS_SCOPE(Stats_Phase_Split_Evaluation);
+
+    f64 best_entropy = DBL_MAX;
+
+    for (size_t col = 0; col < cols; col++)
+      {
+        if (!is_column_used(used_columns, col))
+          {
+            STATS_COUNT(Stats_Counter_Split_Evaluations, 1);
+
+            auto entropy = compute_average_entropy_after_split(tree, data, scratch, histogram, col, sample_count);
+            if (best_entropy > entropy)
+              {
+                std::swap(scratch.front_samples_count, scratch.back_samples_count);
+                best_entropy = entropy;
+                best_column = col;
+              }
+          }
+      }
+  }
+
+  assert(best_column != INVALID_COLUMN_INDEX);
+
+  auto category_count = tree.categories->data[best_column].category_count();
+  node->children = tree.arenas[0].allocate<DecisionTreeNode>(category_count);
+  node->child_count = category_count;
+  node->column_index = best_column;
+  node->category = INVALID_CATEGORY_ID;
+  node->sample_count = sample_count;
+
+  // Empty children take the most common goal category of their parent.
+  auto parent_category = best_goal_category_of(goal_counts, goal_category_count, goal_counts_stride);
+
+  mark_column_used(used_columns, best_column);
+  auto all_child_columns_are_used = are_all_columns_used(used_columns, cols);
+
+  for (size_t category = 0; category < category_count; category++)
+    {
+      auto child = &node->children[category];
+      auto child_sample_count = scratch.back_samples_count[category];
+      auto child_goal_counts = histogram + data.histogram_offsets[best_column] + category * goal_category_count;
+      auto is_leaf = true;
+
+      if (child_sample_count == 0)
+        {
+          child->column_index = tree.goal_index;
+          child->category = parent_category;
+          child->sample_count = sample_count;
+          child->is_empty = true;
+        }
+      else if (all_child_columns_are_used || child_sample_count <= data.sample_count_threshold)
+        {
+          // Histogram of the split column already has counts of goal categories of the child.
+          child->column_index = tree.goal_index;
+          child->category = best_goal_category_of(child_goal_counts, goal_category_count, 1);
+          child->sample_count = child_sample_count;
+        }
+      else
+        {
+          is_leaf = false;
+        }
+
+      if (is_leaf)
+        STATS_COUNT(Stats_Counter_Nodes_Built, 1);
+
+      add_child(category, child, child_sample_count, is_leaf);
+    }
+
+  return best_column;
+}
+
+// Adds samples of 'count' columns to histograms of nodes in one pass over rows. 'bases' has position of every row in
+// 'histograms', without its column.
+template<typename Column>
+void
+count_level_rows(Column **columns, size_t *offsets, size_t count, std::vector<RowIndex> &rows, std::vector<size_t> &bases, size_t goal_category_count, size_t *histograms)
+{
+  // Offsets are copied, otherwise compiler has to reload them after every count it adds.
+  size_t column_offsets[MAX_FUSED_COLUMNS];
+  std::copy(offsets, offsets + count, column_offsets);
+
+  for (size_t i = 0; i < rows.size(); i++)
+    {
+      auto row = rows[i];
+      auto histogram = histograms + bases[i];
+      for (size_t j = 0; j < count; j++)
+        ++histogram[column_offsets[j] + columns[j][row] * goal_category_count];
+    }
+}
+
+// Counts samples of all 'needed_columns' with values of type 'Column', in groups like 'count_samples_of_width' does.
+template<typename Column>
+void
+count_level_samples_of_width(DecisionTreeBuildData &data, std::vector<size_t> &needed_columns, std::vector<RowIndex> &rows, std::vector<size_t> &bases, size_t goal_category_count, size_t *histograms)
+{
+  size_t  columns_count = 0;
+  Column *columns[MAX_FUSED_COLUMNS];
+  size_t  offsets[MAX_FUSED_COLUMNS];
+
+  for (auto col: needed_columns)
+    {
+      if (data.columns[col].width != sizeof(Column))
+        continue;
+
+      columns[columns_count] = data.columns[col].values<Column>();
+      offsets[columns_count] = data.histogram_offsets[col];
+      columns_count++;
+
+      if (columns_count == MAX_FUSED_COLUMNS)
+        {
+          count_level_rows(columns, offsets, columns_count, rows, bases, goal_category_count, histograms);
+          columns_count = 0;
+        }
+    }
+
+  if (columns_count != 0)
+    count_level_rows(columns, offsets, columns_count, rows, bases, goal_category_count, histograms);
+}
+
+// Builds the same tree as 'build_decision_tree' does on all rows. Nodes with at least 'LEVEL_WISE_MIN_NODE_ROWS' rows
+// are built one level at a time. Children of smaller nodes are built depth first by the recursive builder, as their
+// histograms are too small to pay for passes over the level and only take cache from the big ones. Builds serially.
+DecisionTree
+build_decision_tree_level_wise(std::vector<EncodedColumn> &columns, Categories &categories)
+{
+  STATS_SCOPE(Stats_Phase_Build);
+
+  check_row_count(categories);
+
+  auto tree = DecisionTree{ };
+  auto data = DecisionTreeBuildData{ };
+  start_level_wise_build(tree, data, columns, categories);
+
+  size_t max_category_count = 0;
+  for (auto &category: categories.data)
+    max_category_count = std::max(category.category_count(), max_category_count);
+
+  auto goal_category_count = categories.data[tree.goal_index].category_count();
+  auto histogram_size = data.histogram_offsets.back();
+  auto nodes_per_pass = std::max(LEVEL_WISE_HISTOGRAM_BUDGET / (histogram_size * sizeof(size_t)), size_t(1));
+
+  // Rest of the data of the recursive builder, for depth first nodes.
+  auto &scratch = data.scratches[0];
+  scratch.histogram.resize(histogram_size);
+  scratch.offsets.resize(categories.cols, max_category_count + 1);
+
+  // Rows which are still in nodes of the level in increasing order, and node of every one of them. Rows of leaves and
+  // of depth first nodes are dropped after every level, so deep levels don't go over rows that are done.
+  auto rows = std::vector<RowIndex>{ };
+  auto row_nodes = std::vector<uint32_t>{ };
+  auto goals = std::vector<CategoryId>{ };
+  rows.resize(categories.rows);
+  row_nodes.resize(categories.rows);
+  goals.resize(categories.rows);
+
+  for (size_t row = 0; row < categories.rows; row++)
+    rows[row] = row;
+
+  columns[tree.goal_index].visit([&](auto *values)
+  {
+    for (size_t row = 0; row < categories.rows; row++)
+      goals[row] = values[row];
+  });
+
+  // Besides nodes which are split, levels have leaves with samples, which are only counted, so their siblings can
+  // be derived. Their node is null.
+  auto level = DecisionTreeLevel{ };
+  auto next_level = DecisionTreeLevel{ };
+  auto depth_first = DecisionTreeLevel{ };
+  level.words_per_node = next_level.words_per_node = depth_first.words_per_node = (categories.cols + 63) / 64;
+
+  // Node of the level whose histogram is its parent's minus its siblings'. Its siblings are the nodes in
+  // [first_sibling, end_sibling), and the parent is at 'parent' in histograms of the previous level.
+  struct DerivedNode
+  {
+    uint32_t node, parent, first_sibling, end_sibling;
+  };
+
+  // Ids of children which are built depth first have this bit set.
+  constexpr uint32_t DEPTH_FIRST_NODE = uint32_t(1) << 31;
+
+  // Rows of depth first node 'i' are in [depth_first_offsets[i], depth_first_offsets[i + 1]) of 'data.row_indices'.
+  auto depth_first_offsets = std::vector<size_t>{ 0 };
+
+  auto derived_nodes = std::vector<DerivedNode>{ };
+  auto next_derived_nodes = std::vector<DerivedNode>{ };
+  auto is_counted = std::vector<bool>{ };
+  auto histograms = std::vector<size_t>{ };
+  auto parent_histograms = std::vector<size_t>{ };
+  // Rows which are counted in a pass, and their positions in 'histograms'.
+  auto counted_rows = std::vector<RowIndex>{ };
+  auto bases = std::vector<size_t>{ };
+
+  {
+    auto used_columns = std::vector<uint64_t>{ };
+    used_columns.resize(level.words_per_node);
+    mark_column_used(used_columns.data(), tree.goal_index);
+    level.push_back(tree.root, used_columns.data());
+  }
+
+  for (size_t depth = 0; !level.nodes.empty(); depth++)
+    {
+      auto node_count = level.nodes.size();
+      auto is_single_pass = node_count <= nodes_per_pass;
+
+      is_counted.assign(node_count, true);
+      for (auto &derived: derived_nodes)
+        is_counted[derived.node] = false;
+
+      // Column every node of the level is split on, and ids of its children by category.
+      auto split_columns = std::vector<uint32_t>{ };
+      auto children_offsets = std::vector<size_t>{ };
+      auto children_nodes = std::vector<uint32_t>{ };
+      split_columns.assign(node_count, NO_LEVEL_NODE);
+      children_offsets.resize(node_count);
+
+      for (size_t first = 0; first < node_count; first += nodes_per_pass)
+        {
+          auto pass_size = std::min(nodes_per_pass, node_count - first);
+          histograms.assign(pass_size * histogram_size, 0);
+
+          // Columns which some node of the pass can still split on. Derived nodes need them counted for their siblings.
+          auto needed_columns = std::vector<size_t>{ };
+          for (size_t col = 0; col < categories.cols; col++)
+            {
+              auto is_needed = col == tree.goal_index;
+              for (size_t i = first; i < first + pass_size && !is_needed; i++)
+                is_needed = level.nodes[i] && !is_column_used(level.used_columns_of(i), col);
+
+              if (is_needed)
+                needed_columns.push_back(col);
+            }
+
+          {
+            STATS_SCOPE(Stats_Phase_Split_Evaluation);
+
+            // Rows of derived nodes are interleaved with the rest, so they are dropped without branches, which would
+            // be mispredicted all the time.
+            counted_rows.resize(rows.size());
+            bases.resize(rows.size());
+
+            size_t count = 0;
+            for (size_t i = 0; i < rows.size(); i++)
+              {
+                size_t node = row_nodes[i] - first;
+                counted_rows[count] = rows[i];
+                bases[count] = node * histogram_size + goals[i];
+                count += node < pass_size && is_counted[row_nodes[i]];
+              }
+
+            counted_rows.resize(count);
+            bases.resize(count);
+            STATS_COUNT(Stats_Counter_Rows_Scanned, count);
+
+            count_level_samples_of_width<uint8_t>(data, needed_columns, counted_rows, bases, goal_category_count, histograms.data());
+            count_level_samples_of_width<uint16_t>(data, needed_columns, counted_rows, bases, goal_category_count, histograms.data());
+            count_level_samples_of_width<uint32_t>(data, needed_columns, counted_rows, bases, goal_category_count, histograms.data());
+          }
+
+          // Nodes are derived only when the whole level fits in one pass.
+          for (auto &derived: derived_nodes)
+            {
+              auto histogram = histograms.data() + derived.node * histogram_size;
+              auto parent_histogram = parent_histograms.data() + derived.parent * histogram_size;
+              std::copy(parent_histogram, parent_histogram + histogram_size, histogram);
+
+              for (auto sibling = derived.first_sibling; sibling < derived.end_sibling; sibling++)
+                {
+                  if (sibling == derived.node)
+                    continue;
+
+                  auto sibling_histogram = histograms.data() + sibling * histogram_size;
+                  for (size_t j = 0; j < histogram_size; j++)
+                    histogram[j] -= sibling_histogram[j];
+                }
+            }
+
+          for (size_t i = first; i < first + pass_size; i++)
+            {
+              auto node = level.nodes[i];
+              if (!node)
+                continue;
+
+              auto biggest_child = NO_LEVEL_NODE;
+              size_t biggest_child_sample_count = 0;
+              auto first_sibling = next_level.nodes.size();
+              children_offsets[i] = children_nodes.size();
+
+              auto used_columns = level.used_columns_of(i);
+              auto histogram = histograms.data() + (i - first) * histogram_size;
+              auto split_column = split_level_node(tree, data, node, used_columns, histogram, [&](size_t, DecisionTreeNode *child, size_t sample_count, bool is_leaf)
+              {
+                children_nodes.push_back(NO_LEVEL_NODE);
+
+                if (sample_count == 0)
+                  return;
+
+                if (node->sample_count < LEVEL_WISE_MIN_NODE_ROWS)
+                  {
+                    if (!is_leaf)
+                      {
+                        assert(depth_first.nodes.size() < DEPTH_FIRST_NODE);
+                        children_nodes.back() = DEPTH_FIRST_NODE | depth_first.nodes.size();
+                        depth_first.push_back(child, used_columns);
+                        depth_first_offsets.push_back(depth_first_offsets.back() + sample_count);
+                      }
+
+                    return;
+                  }
+
+                // Leaves with samples stay on the next level only when one of their siblings can be derived.
+                if (is_leaf && !is_single_pass)
+                  return;
+
+                assert(next_level.nodes.size() < DEPTH_FIRST_NODE);
+                children_nodes.back() = next_level.nodes.size();
+                next_level.push_back(is_leaf ? nullptr : child, used_columns);
+
+                if (!is_leaf && biggest_child_sample_count < sample_count)
+                  {
+                    biggest_child = children_nodes.back();
+                    biggest_child_sample_count = sample_count;
+                  }
+              });
+
+              if (split_column == INVALID_COLUMN_INDEX)
+                continue;
+
+              split_columns[i] = split_column;
+
+              if (node->sample_count < LEVEL_WISE_MIN_NODE_ROWS)
+                continue;
+
+              if (biggest_child == NO_LEVEL_NODE)
+                {
+                  // Nothing to derive, so leaves don't need to be counted.
+                  next_level.resize(first_sibling);
+                  std::fill(children_nodes.begin() + children_offsets[i], children_nodes.end(), NO_LEVEL_NODE);
+                  continue;
+                }
+
+              next_derived_nodes.push_back({ biggest_child, uint32_t(i), uint32_t(first_sibling), uint32_t(next_level.nodes.size()) });
+            }
+        }
+
+      if (next_level.nodes.empty() && depth_first.nodes.empty())
+        break;
+
+      // Move rows to nodes of the next level, column by column of the level's splits. Rows of depth first nodes are
+      // grouped by node into 'data.row_indices', where the recursive builder wants them, and rows of leaves are dropped.
+      {
+        STATS_SCOPE(Stats_Phase_Partition);
+        STATS_COUNT(Stats_Counter_Rows_Partitioned, rows.size());
+
+        // Rows are moved in one pass for every width of split columns, not for every column. Everything a row needs
+        // from its node is in one place.
+        struct Split
+        {
+          uint8_t *values;
+          uint32_t *children;
+          size_t width;
+        };
+
+        auto splits = std::vector<Split>{ };
+        splits.resize(node_count);
+
+        bool has_width[sizeof(uint32_t) + 1] = { };
+        for (size_t i = 0; i < node_count; i++)
+          {
+            if (split_columns[i] == NO_LEVEL_NODE)
+              continue;
+
+            auto &column = columns[split_columns[i]];
+            splits[i] = { column.bytes.data(), &children_nodes[children_offsets[i]], column.width };
+            has_width[column.width] = true;
+          }
+
+        auto next_row_nodes = std::vector<uint32_t>{ };
+        next_row_nodes.assign(rows.size(), NO_LEVEL_NODE);
+
+        auto move_rows =
+          [&](auto *type)
+          {
+            using Column = std::remove_pointer_t<decltype(type)>;
+
+            if (!has_width[sizeof(Column)])
+              return;
+
+            for (size_t i = 0; i < rows.size(); i++)
+              {
+                auto &split = splits[row_nodes[i]];
+                if (split.width == sizeof(Column))
+                  next_row_nodes[i] = split.children[((Column *)split.values)[rows[i]]];
+              }
+          };
+
+        move_rows((uint8_t *)nullptr);
+        move_rows((uint16_t *)nullptr);
+        move_rows((uint32_t *)nullptr);
+
+        if (!depth_first.nodes.empty())
+          {
+            auto cursors = depth_first_offsets;
+            data.row_indices.resize(depth_first_offsets.back());
+
+            for (size_t i = 0; i < rows.size(); i++)
+              {
+                auto node = next_row_nodes[i];
+                if (node != NO_LEVEL_NODE && (node & DEPTH_FIRST_NODE))
+                  data.row_indices[cursors[node & ~DEPTH_FIRST_NODE]++] = rows[i];
+              }
+          }
+
+        // Leaves end up everywhere, so rows are kept without branches. Rows are written only to positions that were
+        // already read, and both leaves and depth first nodes have ids with the top bit set.
+        size_t kept = 0;
+        for (size_t i = 0; i < rows.size(); i++)
+          {
+            auto node = next_row_nodes[i];
+            rows[kept] = rows[i];
+            row_nodes[kept] = node;
+            goals[kept] = goals[i];
+            kept += node < DEPTH_FIRST_NODE;
+          }
+
+        rows.resize(kept);
+        row_nodes.resize(kept);
+        goals.resize(kept);
+      }
+
+      if (!depth_first.nodes.empty())
+        {
+          data.partition_buffer.resize(data.row_indices.size());
+
+          auto used_columns = std::vector<bool>{ };
+          used_columns.resize(categories.cols);
+
+          for (size_t i = 0; i < depth_first.nodes.size(); i++)
+            {
+              for (size_t col = 0; col < categories.cols; col++)
+                used_columns[col] = is_column_used(depth_first.used_columns_of(i), col);
+
+              auto node = DecisionTreeBuildDataNode{ };
+              node.to_fill = depth_first.nodes[i];
+              node.start_row = data.row_indices.data() + depth_first_offsets[i];
+              node.end_row = data.row_indices.data() + depth_first_offsets[i + 1];
+              node.parent_category = INVALID_CATEGORY_ID;
+              node.parent_sample_count = 0;
+              node.depth = depth + 1;
+              build_decision_tree(tree, node, data, used_columns);
+            }
+
+          depth_first.resize(0);
+          depth_first_offsets.resize(1);
+        }
+
+      // Histograms of this level are parents of the next one only if they were all counted in one pass, and children
+      // are derived only if the next level fits in one pass too.
+      if (is_single_pass && next_level.nodes.size() <= nodes_per_pass)
+        std::swap(parent_histograms, histograms);
+      else
+        next_derived_nodes.clear();
+
+      std::swap(level, next_level);
+      std::swap(derived_nodes, next_derived_nodes);
+      next_level.resize(0);
+      next_derived_nodes.clear();
+    }
+
+  tree.compile();
+
+  return tree;
+}
@@ -0,0 +1,61 @@
+// Everything but entry points, shared by the application and the benchmark.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <type_traits>
+#include <chrono>
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <cfloat>
+#include <cstdio>
+#include <cinttypes>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using i64 = int64_t;
+using f64 = double;
+
+#include "utils.cpp"
+#include "stats.cpp"
+#include "thread-pool.cpp"
+#include "interner.cpp"
+#include "tokenizer.cpp"
+#include "table.cpp"
+#include "quantiles.cpp"
+#include "categories.cpp"
+#include "decision-tree.cpp"
+#include "forest.cpp"
+#include "level-wise.cpp"
+#include "online.cpp"
+#include "model.cpp"
+#include "dataset-cache.cpp"
+#include "out-of-core.cpp"
+#include "codegen.cpp"
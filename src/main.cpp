@@ -1,52 +1,241 @@
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-#include <map>
-#include <set>
-#include <memory>
-#include <limits>
-#include <algorithm>
-
-#include <cmath>
-#include <cstring>
-#include <cstdint>
-#include <cassert>
-#include <cfloat>
-
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stat.h>
-
-using i64 = int64_t;
-using f64 = double;
-
-#include "utils.cpp"
-#include "tokenizer.cpp"
-#include "table.cpp"
-#include "categories.cpp"
-#include "decision-tree.cpp"
+#include "library.cpp"
+
+#define STREAM_BATCH_SIZE 1024
 
 int
 main(int argc, char **argv)
 {
-  auto table = parse_csv_from_file(argc > 1 ? argv[1] : "datasets/test.csv");
-  table.print();
-  auto categories = categorize(table);
-  categories.print();
-  auto dt = build_decision_tree(table, categories);
-  dt.print();
+  const char *filepath = "datasets/test.csv";
+  const char *save_model_path = nullptr;
+  const char *load_model_path = nullptr;
+  const char *cache_path = nullptr;
+  const char *export_cpp_path = nullptr;
+  const char *update_path = nullptr;
+  auto cache_path_storage = std::string{ };
+  auto prepare_only = false;
+  auto show_stats = false;
+  auto out_of_core = false;
+  auto level_wise = false;
+  auto options = CategorizeOptions{ };
+  auto forest_options = ForestOptions{ };
+  auto out_of_core_options = OutOfCoreOptions{ };
+  auto online_options = OnlineOptions{ };
+  options.thread_count = std::thread::hardware_concurrency();
+
+  for (int i = 1; i < argc; i++)
+    {
+      auto arg = std::string_view{ argv[i] };
+
+      if (arg == "--bins" && i + 1 < argc)
+        options.bins_count = parse_count("bins count", argv[++i], 1, MAX_BINS_COUNT);
+      else if (arg == "--quantile-bins")
+        options.binning = Binning_Quantiles;
+      else if (arg == "--save-model" && i + 1 < argc)
+        save_model_path = argv[++i];
+      else if (arg == "--load-model" && i + 1 < argc)
+        load_model_path = argv[++i];
+      else if (arg == "--cache" && i + 1 < argc)
+        cache_path = argv[++i];
+      else if (arg == "--export-cpp" && i + 1 < argc)
+        export_cpp_path = argv[++i];
+      else if (arg == "--update" && i + 1 < argc)
+        update_path = argv[++i];
+      else if (arg == "--prepare")
+        prepare_only = true;
+      else if (arg == "--stats")
+        show_stats = true;
+      else if (arg == "--forest" && i + 1 < argc)
+        forest_options.tree_count = parse_count("count of trees", argv[++i], 1, MAX_FOREST_TREE_COUNT);
+      else if (arg == "--forest-features" && i + 1 < argc)
+        forest_options.feature_count = parse_count("count of features", argv[++i], 1, SIZE_MAX);
+      else if (arg == "--out-of-core")
+        out_of_core = true;
+      else if (arg == "--level-wise")
+        level_wise = true;
+      else if (arg == "--memory-budget" && i + 1 < argc)
+        {
+          // In megabytes.
+          out_of_core_options.memory_budget = parse_count("memory budget", argv[++i], 1, SIZE_MAX >> 20) << 20;
+        }
+      else
+        filepath = argv[i];
+    }
+
+  if (forest_options.tree_count > 0 && (save_model_path || load_model_path || export_cpp_path))
+    {
+      fprintf(stderr, "error: forests can't be saved, loaded or exported.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  if (out_of_core && (forest_options.tree_count > 0 || load_model_path))
+    {
+      fprintf(stderr, "error: only a single tree can be trained out of core.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  if (level_wise && (forest_options.tree_count > 0 || out_of_core || load_model_path))
+    {
+      fprintf(stderr, "error: only a single tree can be trained level wise in memory.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  if (update_path && (forest_options.tree_count > 0 || load_model_path || prepare_only))
+    {
+      fprintf(stderr, "error: only a single tree trained in this run can be updated.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  // Out of core training always goes through the dataset cache.
+  if ((prepare_only || out_of_core) && !cache_path)
+    {
+      cache_path_storage = std::string{ filepath } + ".cache";
+      cache_path = cache_path_storage.c_str();
+    }
+
+  if (show_stats)
+    stats_start();
+
+  // Model file or dataset cache, whatever is loaded from it borrows its memory.
+  auto mapped_file = MappedFile{ };
+  auto categories = Categories{ };
+  auto dt = DecisionTree{ };
+  auto forest = DecisionForest{ };
+
+  if (load_model_path)
+    {
+      // Model is used straight from the mapped file, nothing is trained.
+      mapped_file = map_model_file(load_model_path);
+      categories = load_categories(mapped_file);
+      dt = load_decision_tree(mapped_file, categories);
+    }
+  else
+    {
+      auto columns = std::vector<EncodedColumn>{ };
+
+      if (cache_path)
+        {
+          if (out_of_core)
+            columns = load_or_prepare_dataset_out_of_core(filepath, cache_path, options, out_of_core_options, mapped_file, categories);
+          else
+            columns = load_or_prepare_dataset(filepath, cache_path, options, mapped_file, categories);
+
+          if (prepare_only)
+            {
+              if (show_stats)
+                stats_report(stderr);
+              return 0;
+            }
+        }
+      else
+        {
+          auto table = parse_csv_from_file(filepath);
+          table.print();
+          categories = categorize(table, options);
+          columns = encode_columns(table, categories);
+        }
+
+      categories.print();
+
+      if (forest_options.tree_count > 0)
+        {
+          forest = build_decision_forest(columns, categories, forest_options, options.thread_count);
+          forest.print();
+        }
+      else if (out_of_core)
+        {
+          auto scratch_path = std::string{ cache_path } + ".nodes";
+          dt = build_decision_tree_out_of_core(columns, categories, out_of_core_options, scratch_path.c_str());
+          dt.print();
+        }
+      else if (level_wise)
+        {
+          dt = build_decision_tree_level_wise(columns, categories);
+          dt.print();
+        }
+      else
+        {
+          dt = build_decision_tree(columns, categories, options.thread_count);
+          dt.print();
+        }
+    }
+
+  // Rows of the update file go through the tree once, without training it again.
+  if (update_path)
+    {
+      auto updater = start_online_updates(dt, online_options);
+      size_t rows = 0;
+
+      for_each_csv_batch(update_path, STREAM_BATCH_SIZE, [&](Table &batch)
+      {
+        if (batch.cols != categories.cols + 1 || (!batch.header.empty() && !std::equal(categories.labels.begin(), categories.labels.end(), batch.header.begin() + 1)))
+          {
+            fprintf(stderr, "error: '%s' should have the same columns as the training file.\n", update_path);
+            exit(EXIT_FAILURE);
+          }
+
+        updater.update(batch, 0, batch.rows);
+        rows += batch.rows;
+      });
+
+      updater.compile();
+
+      std::cout << "\nUpdated with " << rows << " rows, " << updater.split_count << " leaves split, "
+                << updater.skipped_rows << " rows skipped\n";
+      dt.print();
+    }
+
+  if (save_model_path)
+    save_model(save_model_path, dt, categories);
+
+  if (export_cpp_path)
+    {
+      // Namespace is named after the file.
+      auto name = std::string_view{ export_cpp_path };
+      name = name.substr(name.find_last_of('/') + 1);
+      name = name.substr(0, name.find('.'));
+      export_cpp_header(export_cpp_path, std::string{ name }.c_str(), dt, categories);
+    }
 
   std::cout << "\nGive me some samples!\n";
 
-  auto samples = parse_csv_from_stdin();
-  for (size_t row = 0; row < samples.rows; row++)
+  auto reader = CsvStreamReader{ };
+  reader.fd = STDIN_FILENO;
+  reader.filepath = "<stdin>";
+  reader.batch_size = STREAM_BATCH_SIZE;
+
+  auto samples = Table{ };
+  auto results = std::vector<CategoryId>{ };
+  auto &goal = categories.data[forest.trees.empty() ? dt.goal_index : forest.goal_index];
+  size_t first_row = 0;
+
+  while (reader.next_batch(samples))
     {
-      auto row_ptr = &samples.grab(row, 0);
-      auto [category, is_ok] = dt.classify_as_string(row_ptr, samples.cols);
-      if (is_ok)
-        std::cout << row << ": " << category << '\n';
+      // Samples don't have the ID and goal columns.
+      if (samples.cols + 1 < categories.cols)
+        {
+          fprintf(stderr, "error: samples should have at least %zu columns, but got %zu.\n", categories.cols - 1, samples.cols);
+          exit(EXIT_FAILURE);
+        }
+
+      results.resize(samples.rows);
+      if (forest.trees.empty())
+        dt.classify_batch(samples, 0, samples.rows, results.data());
       else
-        std::cout << row << ": " << "Couldn't classify\n";
+        forest.classify_batch(samples, 0, samples.rows, results.data());
+
+      for (size_t row = 0; row < samples.rows; row++)
+        {
+          if (results[row] != INVALID_CATEGORY_ID)
+            std::cout << first_row + row << ": " << goal.to_string(results[row]) << '\n';
+          else
+            std::cout << first_row + row << ": " << "Couldn't classify\n";
+        }
+
+      first_row += samples.rows;
+      std::cout.flush();
     }
+
+  // Standard output is taken by classification results.
+  if (show_stats)
+    stats_report(stderr);
 }
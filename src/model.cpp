@@ -0,0 +1,460 @@
+// Model file holds categories and compiled nodes of a decision tree. Every array is stored at an offset aligned to 8
+// bytes, so once the file is mapped, arrays are used in place and loading only takes one pass over nodes and strings
+// to check that nothing points outside of them.
+// Numbers are stored in the byte order of the machine that saved the model. Dataset cache uses the same layout.
+
+#define MODEL_VERSION 1
+#define MODEL_ALIGNMENT 8
+
+constexpr char MODEL_MAGIC[8] = { 'D', 'T', 'M', 'O', 'D', 'E', 'L', '\0' };
+constexpr uint32_t MODEL_BYTE_ORDER_MARK = 0x01020304;
+
+// Start of every binary file.
+struct BinaryFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order_mark;
+  uint64_t file_size;
+};
+
+// Array in the model file, 'size' is count of elements.
+struct ModelArray
+{
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct ModelHeader
+{
+  BinaryFileHeader file;
+  // Count of rows the model was trained on.
+  uint64_t rows;
+  uint64_t goal_index;
+  // Array of 'ModelColumn'.
+  ModelArray columns;
+  ModelArray nodes;
+  ModelArray split_columns;
+};
+
+struct ModelColumn
+{
+  uint32_t type;
+  uint32_t is_uniform;
+  ModelArray label;
+  // Category of integers.
+  ModelArray integers;
+  // Category of decimals.
+  ModelArray edges;
+  f64 min, step;
+  uint64_t count;
+  // Category of strings.
+  ModelArray bytes;
+  ModelArray ends;
+  ModelArray hashes;
+  ModelArray slots;
+};
+
+static_assert(std::is_trivially_copyable_v<CompiledTreeNode> && alignof(CompiledTreeNode) <= MODEL_ALIGNMENT);
+static_assert(sizeof(ModelHeader) % MODEL_ALIGNMENT == 0 && sizeof(ModelColumn) % MODEL_ALIGNMENT == 0);
+
+// Path in the same directory as 'filepath' to write to before renaming it into place. Every process gets its own,
+// so runs which write the same file at once don't write into each other's.
+std::string
+temporary_path_for(const char *filepath)
+{
+  return std::string{ filepath } + '.' + std::to_string(getpid()) + ".tmp";
+}
+
+struct ModelWriter
+{
+  std::vector<char> buffer;
+
+  // Appends uninitialized space for 'count' values, returns its offset.
+  template<typename T>
+  uint64_t reserve(size_t count)
+  {
+    auto offset = (buffer.size() + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+    buffer.resize(offset + count * sizeof(T));
+    return offset;
+  }
+
+  template<typename T>
+  ModelArray append(const T *values, size_t count)
+  {
+    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= MODEL_ALIGNMENT);
+
+    auto result = ModelArray{ };
+    result.offset = reserve<T>(count);
+    result.size = count;
+    if (count != 0)
+      memcpy(buffer.data() + result.offset, values, count * sizeof(T));
+
+    return result;
+  }
+
+  template<typename T>
+  ModelArray append(FlatArray<T> &array)
+  {
+    return append(array.data(), array.size());
+  }
+
+  // Header must start with 'BinaryFileHeader', space for it has to be reserved first. File can be bigger than the
+  // buffer, if the rest of it is written separately.
+  template<typename Header>
+  void write_header(Header &header, const char *magic, uint32_t version, size_t file_size)
+  {
+    memcpy(header.file.magic, magic, sizeof(header.file.magic));
+    header.file.version = version;
+    header.file.byte_order_mark = MODEL_BYTE_ORDER_MARK;
+    header.file.file_size = file_size;
+    memcpy(buffer.data(), &header, sizeof(header));
+  }
+
+  // File is written under a temporary name and then renamed, so nobody maps it half written.
+  template<typename Header>
+  void save(const char *filepath, Header &header, const char *magic, uint32_t version)
+  {
+    write_header(header, magic, version, buffer.size());
+
+    auto temporary_path = temporary_path_for(filepath);
+    auto file = std::ofstream{ temporary_path, std::ios::binary };
+    file.write(buffer.data(), buffer.size());
+    file.close();
+
+    if (!file || rename(temporary_path.c_str(), filepath) == -1)
+      {
+        unlink(temporary_path.c_str());
+        fprintf(stderr, "error: couldn't write '%s'.\n", filepath);
+        exit(EXIT_FAILURE);
+      }
+  }
+};
+
+// Writes categories and returns array of their 'ModelColumn'.
+ModelArray
+write_categories(ModelWriter &writer, Categories &categories)
+{
+  auto columns = std::vector<ModelColumn>{ };
+  columns.resize(categories.cols);
+
+  auto result = ModelArray{ };
+  result.offset = writer.reserve<ModelColumn>(columns.size());
+  result.size = columns.size();
+
+  for (size_t i = 0; i < categories.cols; i++)
+    {
+      auto &category = categories.data[i];
+      auto &column = columns[i];
+      column.type = category.type;
+      column.label = writer.append(categories.labels[i].data(), categories.labels[i].size());
+
+      switch (category.type)
+        {
+        case Category_Of_Integers:
+          column.integers = writer.append(category.as.integers.from);
+          break;
+        case Category_Of_Decimals:
+          {
+            auto &interval = category.as.decimals.interval;
+            column.edges = writer.append(interval.edges);
+            column.min = interval.min;
+            column.step = interval.step;
+            column.count = interval.count;
+            column.is_uniform = interval.is_uniform;
+          }
+
+          break;
+        case Category_Of_Strings:
+          {
+            auto &dictionary = category.as.strings.to;
+            column.bytes = writer.append(dictionary.bytes);
+            column.ends = writer.append(dictionary.ends);
+            column.hashes = writer.append(dictionary.hashes);
+            column.slots = writer.append(dictionary.slots);
+          }
+
+          break;
+        }
+    }
+
+  memcpy(writer.buffer.data() + result.offset, columns.data(), columns.size() * sizeof(ModelColumn));
+
+  return result;
+}
+
+void
+save_model(const char *filepath, DecisionTree &tree, Categories &categories)
+{
+  auto writer = ModelWriter{ };
+  auto header = ModelHeader{ };
+  writer.reserve<ModelHeader>(1);
+
+  header.rows = categories.rows;
+  header.goal_index = tree.goal_index;
+  header.columns = write_categories(writer, categories);
+  header.nodes = writer.append(tree.nodes);
+  header.split_columns = writer.append(tree.split_columns);
+
+  writer.save(filepath, header, MODEL_MAGIC, MODEL_VERSION);
+}
+
+// Mapped model or dataset cache file. Everything loaded from it borrows its memory, so it has to outlive them.
+struct MappedFile
+{
+  const char *filepath;
+  SourceBuffer source;
+
+  [[noreturn]] void report_invalid()
+  {
+    fprintf(stderr, "error: '%s' is corrupted.\n", filepath);
+    exit(EXIT_FAILURE);
+  }
+
+  // Checks that array lies within the file, but not its contents.
+  template<typename T>
+  bool contains(ModelArray array)
+  {
+    auto file_size = source.text.size();
+    return array.offset % MODEL_ALIGNMENT == 0 && array.offset <= file_size && array.size <= (file_size - array.offset) / sizeof(T);
+  }
+
+  template<typename T>
+  T *grab(ModelArray array)
+  {
+    if (!contains<T>(array))
+      report_invalid();
+
+    return (T *)(source.text.data() + array.offset);
+  }
+
+  template<typename T>
+  void borrow(ModelArray array, FlatArray<T> &result)
+  {
+    result.borrow(grab<T>(array), array.size);
+  }
+
+  // Same as 'borrow', but returns false instead of exiting.
+  template<typename T>
+  bool try_borrow(ModelArray array, FlatArray<T> &result)
+  {
+    if (!contains<T>(array))
+      return false;
+
+    result.borrow((T *)(source.text.data() + array.offset), array.size);
+    return true;
+  }
+
+  template<typename Header>
+  Header &header()
+  {
+    auto array = ModelArray{ };
+    array.size = 1;
+    return *grab<Header>(array);
+  }
+};
+
+// Returns false if file doesn't exist, or it isn't a file of this kind and version.
+bool
+try_map_binary_file(const char *filepath, const char *magic, uint32_t version, MappedFile &result)
+{
+  struct stat stats;
+  if (stat(filepath, &stats) == -1 || size_t(stats.st_size) < sizeof(BinaryFileHeader))
+    return false;
+
+  result.filepath = filepath;
+  result.source = map_entire_file(filepath);
+
+  auto &header = result.header<BinaryFileHeader>();
+
+  return memcmp(header.magic, magic, sizeof(header.magic)) == 0
+    && header.version == version
+    && header.byte_order_mark == MODEL_BYTE_ORDER_MARK
+    && header.file_size == result.source.text.size();
+}
+
+MappedFile
+map_model_file(const char *filepath)
+{
+  auto result = MappedFile{ };
+  if (!try_map_binary_file(filepath, MODEL_MAGIC, MODEL_VERSION, result))
+    {
+      fprintf(stderr, "error: '%s' is not a model file of version %u.\n", filepath, MODEL_VERSION);
+      exit(EXIT_FAILURE);
+    }
+
+  // Only a few pages of a model are touched, and not in order.
+  madvise(result.source.mapping, result.source.mapping_size, MADV_RANDOM);
+
+  return result;
+}
+
+// Strings have to lie within their bytes, and slots have to hold valid ids and at least one empty slot,
+// so probing for a string always stops.
+bool
+is_valid_dictionary(StringDictionary &dictionary)
+{
+  auto slot_count = dictionary.slots.size();
+  if (dictionary.hashes.size() != dictionary.size() || dictionary.size() >= INVALID_STRING_ID || (slot_count & (slot_count - 1)) != 0)
+    return false;
+
+  uint64_t start = 0;
+  for (auto end: dictionary.ends)
+    {
+      if (end < start)
+        return false;
+      start = end;
+    }
+
+  if (start > dictionary.bytes.size())
+    return false;
+
+  auto has_empty_slot = false;
+  for (auto id: dictionary.slots)
+    {
+      if (id == StringDictionary::EMPTY_SLOT)
+        has_empty_slot = true;
+      else if (id >= dictionary.size())
+        return false;
+    }
+
+  return slot_count == 0 || has_empty_slot;
+}
+
+// Borrows categories from the file into 'result', returns false if anything in them is out of range.
+bool
+try_load_categories(MappedFile &file, ModelArray column_array, size_t rows, Categories &result)
+{
+  if (!file.contains<ModelColumn>(column_array))
+    return false;
+
+  auto columns = file.grab<ModelColumn>(column_array);
+
+  auto &ct = result;
+  ct = Categories{ };
+  ct.cols = column_array.size;
+  ct.rows = rows;
+  ct.data.reserve(ct.cols);
+  ct.labels.reserve(ct.cols);
+
+  for (size_t i = 0; i < ct.cols; i++)
+    {
+      auto &column = columns[i];
+      if (!file.contains<char>(column.label))
+        return false;
+
+      ct.labels.emplace_back(file.grab<char>(column.label), column.label.size);
+
+      switch (column.type)
+        {
+        case Category_Of_Integers:
+          {
+            auto category = Category{ Category_Of_Integers };
+            if (!file.try_borrow(column.integers, category.as.integers.from))
+              return false;
+
+            ct.data.push_back(std::move(category));
+          }
+
+          break;
+        case Category_Of_Decimals:
+          {
+            auto category = Category{ Category_Of_Decimals };
+            auto &interval = category.as.decimals.interval;
+            if (!file.try_borrow(column.edges, interval.edges))
+              return false;
+
+            interval.min = column.min;
+            interval.step = column.step;
+            interval.count = column.count;
+            interval.is_uniform = column.is_uniform;
+
+            if (interval.count == 0 || interval.edges.size() <= interval.count || interval.edges.size() - 1 != interval.count)
+              return false;
+
+            ct.data.push_back(std::move(category));
+          }
+
+          break;
+        case Category_Of_Strings:
+          {
+            auto category = Category{ Category_Of_Strings };
+            auto &dictionary = category.as.strings.to;
+            if (!file.try_borrow(column.bytes, dictionary.bytes) || !file.try_borrow(column.ends, dictionary.ends)
+                || !file.try_borrow(column.hashes, dictionary.hashes) || !file.try_borrow(column.slots, dictionary.slots))
+              return false;
+
+            if (!is_valid_dictionary(dictionary))
+              return false;
+
+            ct.data.push_back(std::move(category));
+          }
+
+          break;
+        default:
+          return false;
+        }
+    }
+
+  return true;
+}
+
+Categories
+load_categories(MappedFile &file)
+{
+  auto &header = file.header<ModelHeader>();
+  auto result = Categories{ };
+  if (!try_load_categories(file, header.columns, header.rows, result))
+    file.report_invalid();
+
+  return result;
+}
+
+DecisionTree
+load_decision_tree(MappedFile &file, Categories &categories)
+{
+  auto &header = file.header<ModelHeader>();
+  auto tree = DecisionTree{ };
+  tree.categories = &categories;
+  tree.goal_index = header.goal_index;
+  file.borrow(header.nodes, tree.nodes);
+  file.borrow(header.split_columns, tree.split_columns);
+
+  // Goal is the last column, like builders make it, so samples without it have every split column.
+  if (categories.cols == 0 || tree.goal_index != categories.cols - 1 || tree.nodes.empty())
+    file.report_invalid();
+
+  // Split columns are encoded by 'classify_batch', so they have to be sorted, and the goal isn't among them,
+  // since samples don't have it.
+  for (size_t i = 0; i < tree.split_columns.size(); i++)
+    {
+      auto column = tree.split_columns[i];
+      if (column >= categories.cols || column == tree.goal_index || (i > 0 && column <= tree.split_columns[i - 1]))
+        file.report_invalid();
+    }
+
+  // Children come after their parent, as 'compile' lays them out, so classification always reaches a leaf.
+  auto goal_count = categories.data[tree.goal_index].category_count();
+
+  for (size_t i = 0; i < tree.nodes.size(); i++)
+    {
+      auto node = tree.nodes[i];
+
+      if (node.column_index == COMPILED_LEAF)
+        {
+          if (node.payload >= goal_count)
+            file.report_invalid();
+
+          continue;
+        }
+
+      if (!std::binary_search(tree.split_columns.begin(), tree.split_columns.end(), node.column_index))
+        file.report_invalid();
+
+      auto child_count = categories.data[node.column_index].category_count();
+      if (node.payload <= i || node.payload > tree.nodes.size() || child_count > tree.nodes.size() - node.payload)
+        file.report_invalid();
+    }
+
+  return tree;
+}
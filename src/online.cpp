@@ -0,0 +1,345 @@
+// Online training: a tree which is already built learns from new rows without being built again, like Hoeffding trees
+// do. Every leaf counts samples of the new rows that reach it, into the same histogram the builders count, and is split
+// once it has seen enough rows to be confident that its best column would stay the best with any number of rows.
+// Rows are never read again, so every row costs only a walk down the tree and counting its columns into one leaf.
+
+#define ONLINE_GRACE_PERIOD 200
+#define ONLINE_ERROR_PROBABILITY 1e-7
+#define ONLINE_TIE_THRESHOLD 0.05
+
+struct OnlineOptions
+{
+  // Leaf considers a split after every 'grace_period' rows, evaluating columns costs as much as its histogram.
+  size_t grace_period = ONLINE_GRACE_PERIOD;
+  // Chance that a leaf is split on a different column than all rows would choose.
+  f64 error_probability = ONLINE_ERROR_PROBABILITY;
+  // Once the bound gets below it, columns are considered tied, and the leaf is split on the best of them.
+  f64 tie_threshold = ONLINE_TIE_THRESHOLD;
+};
+
+// Samples of rows a leaf got since updates started, or since it was made by a split. Rows it had before aren't known,
+// they only vote for its category. Empty leaves had no rows, so they don't vote, even though they show the count of their parent.
+struct OnlineLeaf
+{
+  // Columns the leaf can still split on, after the goal column which is always first.
+  std::vector<uint32_t> columns;
+  // Histograms of 'columns' one after another, in the same layout as in the builders. Histogram of the goal column has
+  // counts of goal categories on its diagonal.
+  std::vector<size_t> histogram;
+  CategoryId prior_category;
+  size_t prior_sample_count;
+  size_t sample_count;
+  // Samples when the split was considered last time.
+  size_t checked_sample_count;
+};
+
+// Updates a built tree with new rows, call 'compile' after updates to classify with them. Nodes of the tree are
+// needed, so trees loaded from model files can't be updated.
+struct DecisionTreeUpdater
+{
+  DecisionTree *tree;
+  OnlineOptions options;
+  // Only the parts that evaluate splits are filled.
+  DecisionTreeBuildData data;
+  // Size of histogram of every column.
+  std::vector<size_t> histogram_sizes;
+  std::unordered_map<DecisionTreeNode *, OnlineLeaf> leaves;
+  // Rows with categories that the tree doesn't know, which are skipped.
+  size_t skipped_rows = 0;
+  size_t split_count = 0;
+
+  OnlineLeaf &add_leaf(DecisionTreeNode *node, std::vector<uint32_t> columns)
+  {
+    auto &leaf = leaves[node];
+    leaf.columns = std::move(columns);
+
+    size_t histogram_size = 0;
+    for (auto col: leaf.columns)
+      histogram_size += histogram_sizes[col];
+
+    leaf.histogram.resize(histogram_size);
+    leaf.prior_category = node->category;
+    leaf.prior_sample_count = node->is_empty ? 0 : node->sample_count;
+    leaf.sample_count = 0;
+    leaf.checked_sample_count = 0;
+
+    return leaf;
+  }
+
+  // First row which reaches a leaf of the built tree starts its samples. Leaf can split on columns which aren't on the
+  // way to it, 'row' has categories of every column, 'stride' apart.
+  OnlineLeaf &leaf_of(DecisionTreeNode *node, CategoryId *row, size_t stride)
+  {
+    auto found = leaves.find(node);
+    if (found != leaves.end())
+      return found->second;
+
+    auto cols = tree->categories->cols;
+    auto is_used = std::vector<bool>{ };
+    is_used.resize(cols);
+    is_used[tree->goal_index] = true;
+
+    for (auto path = tree->root; path != node; path = &path->children[row[path->column_index * stride]])
+      is_used[path->column_index] = true;
+
+    auto columns = std::vector<uint32_t>{ };
+    columns.push_back(tree->goal_index);
+    for (size_t col = 0; col < cols; col++)
+      if (!is_used[col])
+        columns.push_back(col);
+
+    return add_leaf(node, std::move(columns));
+  }
+
+  // Most common goal category of all samples of the leaf, ties go to the smallest category like in the builders.
+  CategoryId best_goal_category(OnlineLeaf &leaf)
+  {
+    auto goal_category_count = tree->categories->data[tree->goal_index].category_count();
+    auto   best_goal_category = leaf.prior_category;
+    size_t best_sample_count = 0;
+
+    for (size_t category = 0; category < goal_category_count; category++)
+      {
+        auto sample_count = leaf.histogram[category * (goal_category_count + 1)];
+        if (category == leaf.prior_category)
+          sample_count += leaf.prior_sample_count;
+
+        if (best_sample_count < sample_count)
+          {
+            best_sample_count = sample_count;
+            best_goal_category = category;
+          }
+      }
+
+    return best_goal_category;
+  }
+
+  // Splits the leaf if the Hoeffding bound says that its best column is better than the second best one, and than not
+  // splitting at all. Entropies are in bits, so they are at most 'log2(goal_category_count)' apart.
+  void try_split(DecisionTreeNode *node, OnlineLeaf &leaf)
+  {
+    leaf.checked_sample_count = leaf.sample_count;
+
+    if (leaf.columns.size() <= 1 || leaf.sample_count <= data.sample_count_threshold)
+      return;
+
+    STATS_SCOPE(Stats_Phase_Split_Evaluation);
+
+    auto &scratch = data.scratches[0];
+    auto goal_category_count = tree->categories->data[tree->goal_index].category_count();
+    auto histogram = scratch.histogram.data();
+
+    // Evaluation reads histograms at the offsets of the builders.
+    size_t offset = 0;
+    for (auto col: leaf.columns)
+      {
+        std::copy(&leaf.histogram[offset], &leaf.histogram[offset] + histogram_sizes[col], histogram + data.histogram_offsets[col]);
+        offset += histogram_sizes[col];
+      }
+
+    f64 leaf_entropy = n_log2_n(data, leaf.sample_count);
+    for (size_t category = 0; category < goal_category_count; category++)
+      leaf_entropy -= n_log2_n(data, leaf.histogram[category * (goal_category_count + 1)]);
+    leaf_entropy /= leaf.sample_count;
+
+    auto best_column = INVALID_COLUMN_INDEX;
+    f64  best_entropy = DBL_MAX;
+    f64  second_entropy = leaf_entropy;
+
+    for (size_t i = 1; i < leaf.columns.size(); i++)
+      {
+        STATS_COUNT(Stats_Counter_Split_Evaluations, 1);
+
+        auto col = leaf.columns[i];
+        auto entropy = compute_average_entropy_after_split(*tree, data, scratch, histogram, col, leaf.sample_count);
+
+        if (best_entropy > entropy)
+          {
+            std::swap(scratch.front_samples_count, scratch.back_samples_count);
+            second_entropy = std::min(second_entropy, best_entropy);
+            best_entropy = entropy;
+            best_column = col;
+          }
+        else
+          {
+            second_entropy = std::min(second_entropy, entropy);
+          }
+      }
+
+    auto range = std::log2((f64)goal_category_count);
+    auto bound = std::sqrt(range * range * std::log(1 / options.error_probability) / (2 * leaf.sample_count));
+
+    if (best_entropy >= leaf_entropy || (second_entropy - best_entropy <= bound && bound >= options.tie_threshold))
+      return;
+
+    STATS_COUNT(Stats_Counter_Nodes_Built, 1);
+
+    auto category_count = tree->categories->data[best_column].category_count();
+    auto parent_category = best_goal_category(leaf);
+    node->children = tree->arenas[0].allocate<DecisionTreeNode>(category_count);
+    node->child_count = category_count;
+    node->column_index = best_column;
+    node->category = INVALID_CATEGORY_ID;
+    node->sample_count = leaf.prior_sample_count + leaf.sample_count;
+    node->is_empty = false;
+
+    auto child_columns = leaf.columns;
+    child_columns.erase(std::find(child_columns.begin(), child_columns.end(), best_column));
+
+    // Children start with no samples of their own, counts of their parent only choose their categories. Empty children
+    // take the category of their parent, like in the builders.
+    for (size_t category = 0; category < category_count; category++)
+      {
+        auto child = &node->children[category];
+        auto child_sample_count = scratch.back_samples_count[category];
+        child->column_index = tree->goal_index;
+
+        if (child_sample_count == 0)
+          {
+            child->category = parent_category;
+            child->sample_count = node->sample_count;
+            child->is_empty = true;
+          }
+        else
+          {
+            auto child_goal_counts = histogram + data.histogram_offsets[best_column] + category * goal_category_count;
+            child->category = best_goal_category_of(child_goal_counts, goal_category_count, 1);
+            child->sample_count = child_sample_count;
+          }
+
+        add_leaf(child, child_columns);
+      }
+
+    split_count++;
+    leaves.erase(node);
+  }
+
+  // Learns from rows in [start_row, end_row) of 'samples', which are laid out like the training file, with ID column
+  // first and the goal column last.
+  void update(Table &samples, size_t start_row, size_t end_row)
+  {
+    assert(samples.cols == tree->categories->cols + 1);
+
+    STATS_SCOPE(Stats_Phase_Update);
+    STATS_COUNT(Stats_Counter_Rows_Updated, end_row - start_row);
+
+    auto cols = tree->categories->cols;
+    auto goal_category_count = tree->categories->data[tree->goal_index].category_count();
+
+    // Rows are converted to categories in batches, one column per row like in 'classify_batch'.
+    auto encoded = Flattened2DArray<CategoryId>{ };
+    encoded.resize(cols, std::min(size_t(CLASSIFY_BATCH_SIZE), end_row - start_row));
+
+    for (; start_row < end_row; start_row += encoded.cols)
+      {
+        auto count = std::min(encoded.cols, end_row - start_row);
+
+        // Add 1 to ignore first column.
+        for (size_t col = 0; col < cols; col++)
+          tree->categories->data[col].to_categories(samples, col + 1, start_row, start_row + count, &encoded.grab(col, 0));
+
+        for (size_t i = 0; i < count; i++)
+          {
+            auto row = &encoded.grab(0, i);
+            auto node = tree->root;
+
+            while (node->child_count != 0 && row[node->column_index * encoded.cols] != INVALID_CATEGORY_ID)
+              node = &node->children[row[node->column_index * encoded.cols]];
+
+            if (node->child_count != 0)
+              {
+                skipped_rows++;
+                continue;
+              }
+
+            auto &leaf = leaf_of(node, row, encoded.cols);
+
+            auto is_known = true;
+            for (auto col: leaf.columns)
+              is_known = row[col * encoded.cols] != INVALID_CATEGORY_ID && is_known;
+
+            if (!is_known)
+              {
+                skipped_rows++;
+                continue;
+              }
+
+            // Split nodes on the way count the row too.
+            for (auto path = tree->root; path != node; path = &path->children[row[path->column_index * encoded.cols]])
+              path->sample_count++;
+
+            auto   goal_category = row[tree->goal_index * encoded.cols];
+            size_t offset = 0;
+
+            for (auto col: leaf.columns)
+              {
+                ++leaf.histogram[offset + row[col * encoded.cols] * goal_category_count + goal_category];
+                offset += histogram_sizes[col];
+              }
+
+            leaf.sample_count++;
+            if (leaf.sample_count - leaf.checked_sample_count >= options.grace_period)
+              try_split(node, leaf);
+          }
+      }
+  }
+
+  // Sets categories of leaves from their samples, and lays the tree out again. Takes time of the whole tree, so it is
+  // called after a batch of updates and not after every row.
+  void compile()
+  {
+    for (auto &[node, leaf]: leaves)
+      {
+        // Leaves which are still empty keep category and count of their parent.
+        if (leaf.prior_sample_count + leaf.sample_count == 0)
+          continue;
+
+        node->category = best_goal_category(leaf);
+        node->sample_count = leaf.prior_sample_count + leaf.sample_count;
+        node->is_empty = false;
+      }
+
+    tree->compile();
+  }
+};
+
+DecisionTreeUpdater
+start_online_updates(DecisionTree &tree, OnlineOptions &options)
+{
+  assert(tree.root && !tree.arenas.empty());
+
+  auto &categories = *tree.categories;
+  auto goal_category_count = categories.data[tree.goal_index].category_count();
+
+  size_t max_category_count = 0;
+  for (auto &category: categories.data)
+    max_category_count = std::max(category.category_count(), max_category_count);
+
+  auto updater = DecisionTreeUpdater{ };
+  updater.tree = &tree;
+  updater.options = options;
+
+  auto &data = updater.data;
+  data.sample_count_threshold = SAMPLE_COUNT_THRESHOLD;
+  data.pool = nullptr;
+
+  data.histogram_offsets.resize(categories.cols + 1);
+  updater.histogram_sizes.resize(categories.cols);
+  for (size_t col = 0; col < categories.cols; col++)
+    {
+      updater.histogram_sizes[col] = categories.data[col].category_count() * goal_category_count;
+      data.histogram_offsets[col + 1] = data.histogram_offsets[col] + updater.histogram_sizes[col];
+    }
+
+  data.n_log2_n_table.resize(N_LOG2_N_TABLE_SIZE);
+  for (size_t n = 1; n < data.n_log2_n_table.size(); n++)
+    data.n_log2_n_table[n] = n * std::log2((f64)n);
+
+  data.scratches.resize(1);
+  auto &scratch = data.scratches[0];
+  scratch.histogram.resize(data.histogram_offsets.back());
+  scratch.front_samples_count.resize(max_category_count);
+  scratch.back_samples_count.resize(max_category_count);
+
+  return updater;
+}
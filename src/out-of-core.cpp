@@ -0,0 +1,546 @@
+// Out of core training, for datasets that don't fit in memory. CSV file is read in batches twice: first to find
+// categories of every column, then to convert rows to categories, which are written straight into a dataset cache.
+// Tree is then built level by level. Every level takes sequential passes over blocks of the mapped cache, which count
+// samples of many nodes of the level at once, and one more pass which moves rows to the children. Node of every row is
+// kept in a scratch file. Memory doesn't depend on count of rows, only on the budget, categories and size of the tree.
+
+#define OUT_OF_CORE_MEMORY_BUDGET (256 << 20)
+#define OUT_OF_CORE_MIN_BLOCK_ROWS 4096
+// Rough memory taken by a parsed row: its text, values and strings.
+#define OUT_OF_CORE_PARSED_ROW_SIZE 1024
+
+struct OutOfCoreOptions
+{
+  size_t memory_budget = OUT_OF_CORE_MEMORY_BUDGET;
+};
+
+// Quarter of the budget goes to buffers of a block of rows, the rest to histograms.
+size_t
+out_of_core_block_rows(OutOfCoreOptions &options, size_t row_size)
+{
+  return std::max(size_t(OUT_OF_CORE_MIN_BLOCK_ROWS), options.memory_budget / 4 / row_size);
+}
+
+void
+read_exactly(int fd, void *data, size_t size, size_t offset, const char *filepath)
+{
+  while (size > 0)
+    {
+      auto count = pread(fd, data, size, offset);
+      if (count <= 0)
+        {
+          fprintf(stderr, "error: couldn't read '%s'.\n", filepath);
+          exit(EXIT_FAILURE);
+        }
+
+      data = (char *)data + count;
+      size -= count;
+      offset += count;
+    }
+}
+
+void
+write_exactly(int fd, const void *data, size_t size, size_t offset, const char *filepath)
+{
+  while (size > 0)
+    {
+      auto count = pwrite(fd, data, size, offset);
+      if (count <= 0)
+        {
+          fprintf(stderr, "error: couldn't write '%s'.\n", filepath);
+          exit(EXIT_FAILURE);
+        }
+
+      data = (const char *)data + count;
+      size -= count;
+      offset += count;
+    }
+}
+
+// Drops pages which lie entirely within memory of a read only file mapping, they are read again if touched.
+void
+release_mapped_pages(const void *start, size_t size)
+{
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  auto first = ((uintptr_t)start + page_size - 1) / page_size * page_size;
+  auto last = ((uintptr_t)start + size) / page_size * page_size;
+
+  if (first < last)
+    madvise((void *)first, last - first, MADV_DONTNEED);
+}
+
+// Calls 'function' with every batch of rows of the CSV file, the first batch also has the header.
+template<typename Function>
+void
+for_each_csv_batch(const char *filepath, size_t batch_size, Function &&function)
+{
+  auto reader = CsvStreamReader{ };
+  reader.fd = open(filepath, O_RDONLY);
+  reader.filepath = filepath;
+  reader.batch_size = batch_size;
+  reader.has_header = true;
+
+  if (reader.fd == -1)
+    {
+      fprintf(stderr, "error: couldn't open '%s'.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+
+  auto batch = Table{ };
+  while (reader.next_batch(batch))
+    function(batch);
+
+  close(reader.fd);
+}
+
+// Everything needed to categorize a column, collected batch by batch. Same as 'categorize', except that quantiles are
+// estimated by one sketch.
+struct StreamedColumn
+{
+  TableCellType type;
+  bool is_typed = false;
+  CategoryOfIntegers integers;
+  StringDictionary strings;
+  // Integers which don't fit into categories are binned like decimals.
+  f64 min = DBL_MAX, max = -DBL_MAX;
+  QuantileSketch sketch;
+
+  void add_number(f64 value, CategorizeOptions &options)
+  {
+    min = std::min(min, value);
+    max = std::max(max, value);
+
+    if (options.binning == Binning_Quantiles)
+      sketch.add(value);
+  }
+
+  void add(Table &batch, size_t col, std::string &label, CategorizeOptions &options)
+  {
+    auto &column = batch.columns[col];
+
+    if (column.is_mixed() || (is_typed && column.type != type))
+      {
+        fprintf(stderr, "error: column '%s' has cells of different types.\n", label.c_str());
+        exit(EXIT_FAILURE);
+      }
+
+    type = column.type;
+    is_typed = true;
+
+    switch (type)
+      {
+      case Table_Cell_Integer:
+        for (auto value: column.values)
+          {
+            if (integers.from.size() <= MAX_CATEGORIES_FOR_INTEGERS && integers.find(value.integer) == INVALID_CATEGORY_ID)
+              integers.from.push_back(value.integer);
+
+            add_number(value.integer, options);
+          }
+
+        break;
+      case Table_Cell_Decimal:
+        for (auto value: column.values)
+          add_number(value.decimal, options);
+
+        break;
+      case Table_Cell_String:
+        for (auto value: column.values)
+          strings.intern(batch.string_pool[value.string]);
+
+        break;
+      }
+  }
+
+  SubdividedInterval subdivide(CategorizeOptions &options)
+  {
+    switch (options.binning)
+      {
+      case Binning_Equal_Width:
+        return bucketize(min, max, options.bins_count);
+      case Binning_Quantiles:
+        sketch.compress();
+        return bucketize_by_quantiles(sketch, options.bins_count);
+      }
+
+    UNREACHABLE();
+  }
+
+  Category finish(CategorizeOptions &options)
+  {
+    if (type == Table_Cell_String)
+      {
+        auto category = Category{ Category_Of_Strings };
+        category.as.strings.to = std::move(strings);
+        return category;
+      }
+
+    if (type == Table_Cell_Integer && integers.from.size() <= MAX_CATEGORIES_FOR_INTEGERS)
+      {
+        auto category = Category{ Category_Of_Integers };
+        category.as.integers = std::move(integers);
+        return category;
+      }
+
+    auto category = Category{ Category_Of_Decimals };
+    category.as.decimals.interval = subdivide(options);
+    return category;
+  }
+};
+
+// Categorizes the CSV file while reading it in batches, columns are numbered like in 'categorize'.
+Categories
+categorize_out_of_core(const char *filepath, CategorizeOptions &options, size_t batch_size)
+{
+  STATS_SCOPE(Stats_Phase_Categorize);
+
+  auto ct = Categories{ };
+  auto streamed = std::vector<StreamedColumn>{ };
+
+  for_each_csv_batch(filepath, batch_size, [&](Table &batch)
+  {
+    if (streamed.empty())
+      {
+        if (batch.cols < 3 || batch.header.size() != batch.cols)
+          {
+            fprintf(stderr, "error: '%s' should have a header and at least three columns.\n", filepath);
+            exit(EXIT_FAILURE);
+          }
+
+        ct.cols = batch.cols - 1;
+        for (size_t i = 1; i < batch.cols; i++)
+          ct.labels.push_back(batch.header[i]);
+
+        streamed.resize(ct.cols);
+      }
+
+    for (size_t col = 0; col < ct.cols && batch.rows > 0; col++)
+      streamed[col].add(batch, col + 1, ct.labels[col], options);
+
+    ct.rows += batch.rows;
+  });
+
+  if (ct.rows == 0)
+    {
+      fprintf(stderr, "error: '%s' has no rows.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+
+  for (auto &column: streamed)
+    ct.data.push_back(column.finish(options));
+
+  return ct;
+}
+
+// Writes dataset cache of the CSV file, without ever holding more than a batch of its rows. Cache is written to a
+// temporary file first, so an interrupted run doesn't leave a cache that looks valid.
+void
+prepare_dataset_out_of_core(const char *filepath, const char *cache_path, CategorizeOptions &options, OutOfCoreOptions &out_of_core, DatasetCacheHeader &expected)
+{
+  auto batch_size = out_of_core_block_rows(out_of_core, OUT_OF_CORE_PARSED_ROW_SIZE);
+  auto categories = categorize_out_of_core(filepath, options, batch_size);
+
+  STATS_SCOPE(Stats_Phase_Encode);
+
+  // Everything but the encoded columns is small, and is written from memory.
+  auto writer = ModelWriter{ };
+  auto header = expected;
+  writer.reserve<DatasetCacheHeader>(1);
+  header.rows = categories.rows;
+  header.columns = write_categories(writer, categories);
+  header.encoded.offset = writer.reserve<ModelArray>(categories.cols);
+  header.encoded.size = categories.cols;
+
+  auto encoded = std::vector<ModelArray>{ };
+  auto widths = std::vector<size_t>{ };
+  size_t file_size = writer.buffer.size();
+
+  for (size_t col = 0; col < categories.cols; col++)
+    {
+      widths.push_back(EncodedColumn::width_for(categories.data[col].category_count()));
+
+      auto array = ModelArray{ };
+      array.offset = (file_size + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+      array.size = categories.rows * widths[col];
+      encoded.push_back(array);
+      file_size = array.offset + array.size;
+    }
+
+  memcpy(writer.buffer.data() + header.encoded.offset, encoded.data(), encoded.size() * sizeof(ModelArray));
+  writer.write_header(header, DATASET_CACHE_MAGIC, DATASET_CACHE_VERSION, file_size);
+
+  auto temporary_path = temporary_path_for(cache_path);
+  int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 || ftruncate(fd, file_size) == -1)
+    {
+      fprintf(stderr, "error: couldn't write '%s'.\n", temporary_path.c_str());
+      exit(EXIT_FAILURE);
+    }
+
+  write_exactly(fd, writer.buffer.data(), writer.buffer.size(), 0, temporary_path.c_str());
+
+  size_t first_row = 0;
+  auto ids = std::vector<CategoryId>{ };
+  auto bytes = std::vector<uint8_t>{ };
+
+  for_each_csv_batch(filepath, batch_size, [&](Table &batch)
+  {
+    if (batch.cols != categories.cols + 1 || first_row + batch.rows > categories.rows)
+      {
+        fprintf(stderr, "error: '%s' has changed while it was read.\n", filepath);
+        exit(EXIT_FAILURE);
+      }
+
+    ids.resize(batch.rows);
+
+    for (size_t col = 0; col < categories.cols; col++)
+      {
+        auto column = EncodedColumn{ };
+        column.resize(batch.rows, categories.data[col].category_count());
+
+        // Add 1 to ignore first column.
+        categories.data[col].to_categories(batch, col + 1, 0, batch.rows, ids.data());
+
+        column.visit([&](auto *values)
+        {
+          for (size_t row = 0; row < batch.rows; row++)
+            {
+              // Values which weren't there when the file was categorized.
+              if (ids[row] == INVALID_CATEGORY_ID)
+                {
+                  fprintf(stderr, "error: '%s' has changed while it was read.\n", filepath);
+                  exit(EXIT_FAILURE);
+                }
+
+              values[row] = ids[row];
+            }
+        });
+
+        write_exactly(fd, column.bytes.data(), column.bytes.size(), encoded[col].offset + first_row * widths[col], temporary_path.c_str());
+      }
+
+    first_row += batch.rows;
+  });
+
+  if (first_row != categories.rows)
+    {
+      fprintf(stderr, "error: '%s' has changed while it was read.\n", filepath);
+      exit(EXIT_FAILURE);
+    }
+
+  if (close(fd) == -1 || rename(temporary_path.c_str(), cache_path) == -1)
+    {
+      fprintf(stderr, "error: couldn't write '%s'.\n", cache_path);
+      exit(EXIT_FAILURE);
+    }
+}
+
+// Like 'load_or_prepare_dataset', but the cache is prepared without loading the whole file.
+std::vector<EncodedColumn>
+load_or_prepare_dataset_out_of_core(const char *filepath, const char *cache_path, CategorizeOptions &options, OutOfCoreOptions &out_of_core, MappedFile &cache, Categories &categories)
+{
+  auto expected = expected_dataset_cache_header(filepath, options);
+  auto columns = std::vector<EncodedColumn>{ };
+
+  if (!try_load_dataset_cache(cache_path, expected, cache, categories, columns))
+    {
+      cache = MappedFile{ };
+      prepare_dataset_out_of_core(filepath, cache_path, options, out_of_core, expected);
+
+      if (!try_load_dataset_cache(cache_path, expected, cache, categories, columns))
+        cache.report_invalid();
+    }
+
+  // Columns are scanned from start to end on every level.
+  madvise(cache.source.mapping, cache.source.mapping_size, MADV_SEQUENTIAL);
+
+  return columns;
+}
+
+// Builds the same tree as 'build_decision_tree' does on all rows, from columns of a mapped dataset cache. Row to node
+// assignments are kept in a scratch file at 'scratch_path', which is removed right away.
+DecisionTree
+build_decision_tree_out_of_core(std::vector<EncodedColumn> &columns, Categories &categories, OutOfCoreOptions &options, const char *scratch_path)
+{
+  STATS_SCOPE(Stats_Phase_Build);
+
+  check_row_count(categories);
+
+  // Splits are chosen by the same code as in the other builders.
+  auto tree = DecisionTree{ };
+  auto data = DecisionTreeBuildData{ };
+  start_level_wise_build(tree, data, columns, categories);
+
+  auto goal_category_count = categories.data[tree.goal_index].category_count();
+  auto histogram_size = data.histogram_offsets.back();
+
+  // Node of every row, at first all rows are in the root. Rows of leaves are in no node.
+  int fd = open(scratch_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1 || unlink(scratch_path) == -1 || ftruncate(fd, categories.rows * sizeof(uint32_t)) == -1)
+    {
+      fprintf(stderr, "error: couldn't create '%s'.\n", scratch_path);
+      exit(EXIT_FAILURE);
+    }
+
+  // Node ids before and after the move, and the goal column.
+  auto block_rows = out_of_core_block_rows(options, 3 * sizeof(uint32_t));
+  auto nodes = std::vector<uint32_t>{ };
+  auto next_nodes = std::vector<uint32_t>{ };
+  auto goals = std::vector<uint32_t>{ };
+  nodes.resize(block_rows);
+  next_nodes.resize(block_rows);
+  goals.resize(block_rows);
+
+  auto histogram_budget = options.memory_budget - std::min(options.memory_budget, block_rows * 3 * sizeof(uint32_t));
+  auto nodes_per_pass = std::max(histogram_budget / (histogram_size * sizeof(size_t)), size_t(1));
+
+  auto level = DecisionTreeLevel{ };
+  auto next_level = DecisionTreeLevel{ };
+  level.words_per_node = next_level.words_per_node = (categories.cols + 63) / 64;
+  auto histograms = std::vector<size_t>{ };
+
+  {
+    auto used_columns = std::vector<uint64_t>{ };
+    used_columns.resize(level.words_per_node);
+    mark_column_used(used_columns.data(), tree.goal_index);
+    level.push_back(tree.root, used_columns.data());
+  }
+
+  auto for_each_block =
+    [&](auto &&function)
+    {
+      for (size_t start = 0; start < categories.rows; start += block_rows)
+        {
+          auto count = std::min(block_rows, categories.rows - start);
+          read_exactly(fd, nodes.data(), count * sizeof(uint32_t), start * sizeof(uint32_t), scratch_path);
+          function(start, count);
+        }
+    };
+
+  // Calls 'function' with values of rows of the block, and releases their pages after.
+  auto visit_block =
+    [&](size_t col, size_t start, size_t count, auto &&function)
+    {
+      auto &column = columns[col];
+      column.visit([&](auto *values) { function(values + start); });
+      release_mapped_pages(column.bytes.data() + start * column.width, count * column.width);
+    };
+
+  while (!level.nodes.empty())
+    {
+      // Column every node of the level is split on, and ids of its children on the next level by category.
+      auto split_columns = std::vector<uint32_t>{ };
+      auto children_offsets = std::vector<size_t>{ };
+      auto children_nodes = std::vector<uint32_t>{ };
+      split_columns.assign(level.nodes.size(), NO_LEVEL_NODE);
+      children_offsets.resize(level.nodes.size());
+
+      for (size_t first = 0; first < level.nodes.size(); first += nodes_per_pass)
+        {
+          auto pass_size = std::min(nodes_per_pass, level.nodes.size() - first);
+          histograms.assign(pass_size * histogram_size, 0);
+
+          // Columns which some node of the pass can still split on.
+          auto is_needed = std::vector<bool>{ };
+          is_needed.resize(categories.cols);
+          is_needed[tree.goal_index] = true;
+          for (size_t i = first; i < first + pass_size; i++)
+            for (size_t col = 0; col < categories.cols; col++)
+              is_needed[col] = is_needed[col] || !is_column_used(level.used_columns_of(i), col);
+
+          for_each_block([&](size_t start, size_t count)
+          {
+            STATS_COUNT(Stats_Counter_Rows_Scanned, count);
+
+            visit_block(tree.goal_index, start, count, [&](auto *values)
+            {
+              for (size_t row = 0; row < count; row++)
+                goals[row] = values[row];
+            });
+
+            for (size_t col = 0; col < categories.cols; col++)
+              {
+                if (!is_needed[col])
+                  continue;
+
+                auto offset = data.histogram_offsets[col];
+
+                visit_block(col, start, count, [&](auto *values)
+                {
+                  for (size_t row = 0; row < count; row++)
+                    {
+                      // Rows of leaves and of nodes outside of the pass wrap around.
+                      size_t node = nodes[row] - first;
+                      if (node < pass_size)
+                        ++histograms[node * histogram_size + offset + values[row] * goal_category_count + goals[row]];
+                    }
+                });
+              }
+          });
+
+          for (size_t i = first; i < first + pass_size; i++)
+            {
+              children_offsets[i] = children_nodes.size();
+
+              auto used_columns = level.used_columns_of(i);
+              auto histogram = histograms.data() + (i - first) * histogram_size;
+              auto split_column = split_level_node(tree, data, level.nodes[i], used_columns, histogram, [&](size_t, DecisionTreeNode *child, size_t, bool is_leaf)
+              {
+                children_nodes.push_back(NO_LEVEL_NODE);
+
+                if (!is_leaf)
+                  {
+                    children_nodes.back() = next_level.nodes.size();
+                    next_level.push_back(child, used_columns);
+                  }
+              });
+
+              if (split_column != INVALID_COLUMN_INDEX)
+                split_columns[i] = split_column;
+            }
+        }
+
+      if (next_level.nodes.empty())
+        break;
+
+      // Move rows to nodes of the next level, column by column of the level's splits.
+      auto is_split_column = std::vector<bool>{ };
+      is_split_column.resize(categories.cols);
+      for (auto column: split_columns)
+        if (column != NO_LEVEL_NODE)
+          is_split_column[column] = true;
+
+      for_each_block([&](size_t start, size_t count)
+      {
+        STATS_COUNT(Stats_Counter_Rows_Partitioned, count);
+
+        std::fill(next_nodes.begin(), next_nodes.begin() + count, NO_LEVEL_NODE);
+
+        for (size_t col = 0; col < categories.cols; col++)
+          {
+            if (!is_split_column[col])
+              continue;
+
+            visit_block(col, start, count, [&](auto *values)
+            {
+              for (size_t row = 0; row < count; row++)
+                {
+                  auto node = nodes[row];
+                  if (node != NO_LEVEL_NODE && split_columns[node] == col)
+                    next_nodes[row] = children_nodes[children_offsets[node] + values[row]];
+                }
+            });
+          }
+
+        write_exactly(fd, next_nodes.data(), count * sizeof(uint32_t), start * sizeof(uint32_t), scratch_path);
+      });
+
+      std::swap(level, next_level);
+      next_level.resize(0);
+    }
+
+  close(fd);
+  tree.compile();
+
+  return tree;
+}
@@ -0,0 +1,129 @@
+#define QUANTILE_SKETCH_COMPRESSION 200
+
+struct Centroid
+{
+  f64 mean, weight;
+};
+
+// Merging t-digest: approximates distribution of values with a bounded number of centroids, which are small near
+// the tails and large in the middle. Sketches of parts of data can be merged, so they can be built on several threads.
+struct QuantileSketch
+{
+  f64 compression = QUANTILE_SKETCH_COMPRESSION;
+  // Sorted by mean, only valid after 'compress'.
+  std::vector<Centroid> centroids;
+  std::vector<Centroid> buffer;
+  f64 min = DBL_MAX, max = -DBL_MAX;
+
+  void add(f64 value)
+  {
+    buffer.push_back({ value, 1 });
+    min = std::min(min, value);
+    max = std::max(max, value);
+
+    if (buffer.size() >= 8 * compression)
+      compress();
+  }
+
+  void merge(QuantileSketch &other)
+  {
+    buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+    buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    compress();
+  }
+
+  // Scale function, centroid may only span one unit of it.
+  f64 scale(f64 q)
+  {
+    return compression / (2 * M_PI) * std::asin(2 * q - 1);
+  }
+
+  f64 inverse_scale(f64 k)
+  {
+    return (std::sin(k * 2 * M_PI / compression) + 1) / 2;
+  }
+
+  void compress()
+  {
+    if (buffer.empty())
+      return;
+
+    buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+    std::sort(buffer.begin(), buffer.end(),
+              [](const Centroid &left, const Centroid &right) { return left.mean < right.mean; });
+
+    f64 total_weight = 0;
+    for (auto &centroid: buffer)
+      total_weight += centroid.weight;
+
+    centroids.clear();
+
+    auto current = buffer[0];
+    f64 weight_so_far = 0;
+    f64 limit = inverse_scale(scale(0) + 1);
+
+    for (size_t i = 1; i < buffer.size(); i++)
+      {
+        auto &next = buffer[i];
+        auto q = (weight_so_far + current.weight + next.weight) / total_weight;
+
+        if (q <= limit)
+          {
+            current.weight += next.weight;
+            current.mean += (next.mean - current.mean) * next.weight / current.weight;
+          }
+        else
+          {
+            weight_so_far += current.weight;
+            centroids.push_back(current);
+            limit = inverse_scale(scale(weight_so_far / total_weight) + 1);
+            current = next;
+          }
+      }
+
+    centroids.push_back(current);
+    buffer.clear();
+  }
+
+  // Approximate value below which 'q' of all values are.
+  f64 quantile(f64 q)
+  {
+    compress();
+    assert(!centroids.empty());
+
+    f64 total_weight = 0;
+    for (auto &centroid: centroids)
+      total_weight += centroid.weight;
+
+    auto target = q * total_weight;
+    auto &first = centroids.front();
+    auto &last = centroids.back();
+
+    // Centroids are treated as points in the middle of their weight, values between them are interpolated.
+    if (target <= first.weight / 2)
+      return min + (first.mean - min) * (first.weight > 1 ? target / (first.weight / 2) : 0);
+    if (target >= total_weight - last.weight / 2)
+      {
+        auto left = total_weight - target;
+        return max - (max - last.mean) * (last.weight > 1 ? left / (last.weight / 2) : 0);
+      }
+
+    f64 center = first.weight / 2;
+    for (size_t i = 0; i + 1 < centroids.size(); i++)
+      {
+        auto next_center = center + (centroids[i].weight + centroids[i + 1].weight) / 2;
+
+        if (target <= next_center)
+          {
+            auto t = (target - center) / (next_center - center);
+            return centroids[i].mean + t * (centroids[i + 1].mean - centroids[i].mean);
+          }
+
+        center = next_center;
+      }
+
+    return last.mean;
+  }
+};
@@ -0,0 +1,270 @@
+// Instrumentation: time spent in phases, event counters, and hardware counters of the main phases when the kernel
+// allows them. Everything is off unless 'global_stats.is_enabled' is set, and compiled out with 'STATS_DISABLED'.
+//
+// Main phases are timed on the thread that runs them. Nested phases, like split evaluation, are summed over all
+// threads, so with more threads they can add up to more than the phase they are part of.
+//
+// Hardware counters of a main phase count the thread that runs it, and only those threads it started which had exited
+// by the end of the phase. Workers of a pool which is still alive aren't counted, the report says so.
+
+enum StatsPhase
+  {
+    // Main phases, which also read hardware counters.
+    Stats_Phase_Parse,
+    Stats_Phase_Categorize,
+    Stats_Phase_Encode,
+    Stats_Phase_Build,
+    Stats_Phase_Classify,
+    Stats_Phase_Update,
+    Stats_Main_Phase_Count,
+
+    Stats_Phase_Split_Evaluation = Stats_Main_Phase_Count,
+    Stats_Phase_Partition,
+    Stats_Phase_Count,
+  };
+
+enum StatsCounter
+  {
+    Stats_Counter_Nodes_Built,
+    Stats_Counter_Split_Evaluations,
+    Stats_Counter_Rows_Scanned,
+    Stats_Counter_Rows_Partitioned,
+    Stats_Counter_Rows_Classified,
+    Stats_Counter_Rows_Updated,
+    Stats_Counter_Heap_Allocations,
+    Stats_Counter_Count,
+  };
+
+enum StatsHardwareCounter
+  {
+    Stats_Hardware_Cycles,
+    Stats_Hardware_Instructions,
+    Stats_Hardware_Cache_Misses,
+    Stats_Hardware_Branch_Misses,
+    Stats_Hardware_Count,
+  };
+
+const char *STATS_PHASE_NAMES[Stats_Phase_Count] = { "parse", "categorize", "encode", "build", "classify", "update", "split_evaluation", "partition" };
+const char *STATS_COUNTER_NAMES[Stats_Counter_Count] = { "nodes_built", "split_evaluations", "rows_scanned", "rows_partitioned", "rows_classified", "rows_updated", "heap_allocations" };
+const char *STATS_HARDWARE_NAMES[Stats_Hardware_Count] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+// Every thread writes only to its own block. Blocks are allocated with malloc, because allocations themselves are
+// counted, and they are never freed, so they can be read after their thread is gone.
+struct StatsThreadBlock
+{
+  uint64_t nanoseconds[Stats_Phase_Count];
+  uint64_t calls[Stats_Phase_Count];
+  uint64_t counters[Stats_Counter_Count];
+  StatsThreadBlock *next;
+};
+
+struct Stats
+{
+  bool is_enabled = false;
+  std::atomic<StatsThreadBlock *> blocks{ nullptr };
+  // Counters are opened by the thread which enables stats. Threads it starts later are added to them by the kernel
+  // only once they exit.
+  bool has_hardware_counters = false;
+  int hardware_fds[Stats_Hardware_Count];
+  uint64_t hardware[Stats_Main_Phase_Count][Stats_Hardware_Count];
+};
+
+Stats global_stats;
+
+StatsThreadBlock &
+stats_thread_block()
+{
+  thread_local StatsThreadBlock *block = nullptr;
+
+  if (!block)
+    {
+      block = (StatsThreadBlock *)calloc(1, sizeof(StatsThreadBlock));
+      if (!block)
+        abort();
+
+      block->next = global_stats.blocks.load();
+      while (!global_stats.blocks.compare_exchange_weak(block->next, block))
+        ;
+    }
+
+  return *block;
+}
+
+void
+stats_read_hardware(uint64_t *values)
+{
+  for (size_t i = 0; i < Stats_Hardware_Count; i++)
+    if (read(global_stats.hardware_fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      values[i] = 0;
+}
+
+struct StatsScope
+{
+  StatsPhase phase;
+  bool is_active;
+  std::chrono::steady_clock::time_point start;
+  uint64_t hardware_start[Stats_Hardware_Count];
+
+  StatsScope(StatsPhase phase)
+    : phase(phase), is_active(global_stats.is_enabled)
+  {
+    if (!is_active)
+      return;
+
+    if (phase < Stats_Main_Phase_Count && global_stats.has_hardware_counters)
+      stats_read_hardware(hardware_start);
+
+    start = std::chrono::steady_clock::now();
+  }
+
+  ~StatsScope()
+  {
+    if (!is_active)
+      return;
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto &block = stats_thread_block();
+    block.nanoseconds[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    block.calls[phase] += 1;
+
+    if (phase < Stats_Main_Phase_Count && global_stats.has_hardware_counters)
+      {
+        uint64_t hardware_end[Stats_Hardware_Count];
+        stats_read_hardware(hardware_end);
+
+        for (size_t i = 0; i < Stats_Hardware_Count; i++)
+          global_stats.hardware[phase][i] += hardware_end[i] - hardware_start[i];
+      }
+  }
+};
+
+#ifdef STATS_DISABLED
+
+#define STATS_SCOPE(phase)
+#define STATS_COUNT(counter, count) ((void)0)
+
+#else
+
+#define STATS_CONCATENATE_(left, right) left##right
+#define STATS_CONCATENATE(left, right) STATS_CONCATENATE_(left, right)
+#define STATS_SCOPE(phase) StatsScope STATS_CONCATENATE(stats_scope_, __LINE__){ phase }
+#define STATS_COUNT(counter, count)                                     \
+  do                                                                    \
+    {                                                                   \
+      if (global_stats.is_enabled)                                      \
+        stats_thread_block().counters[counter] += (count);              \
+    }                                                                   \
+  while (false)
+
+// Kept out of line, so compiler doesn't see 'free' of memory from 'new'.
+__attribute__((noinline)) void *
+operator new(size_t size)
+{
+  STATS_COUNT(Stats_Counter_Heap_Allocations, 1);
+
+  if (auto result = malloc(size ? size : 1))
+    return result;
+
+  throw std::bad_alloc{ };
+}
+
+__attribute__((noinline)) void
+operator delete(void *pointer) noexcept
+{
+  free(pointer);
+}
+
+__attribute__((noinline)) void
+operator delete(void *pointer, size_t) noexcept
+{
+  free(pointer);
+}
+
+#endif
+
+// Turns stats on, hardware counters are used only if the kernel lets us open them.
+void
+stats_start()
+{
+#ifdef STATS_DISABLED
+  fprintf(stderr, "warning: stats are compiled out.\n");
+#else
+  uint64_t configs[Stats_Hardware_Count] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+  };
+
+  global_stats.has_hardware_counters = true;
+
+  for (size_t i = 0; i < Stats_Hardware_Count; i++)
+    {
+      struct perf_event_attr attributes;
+      memset(&attributes, 0, sizeof(attributes));
+      attributes.size = sizeof(attributes);
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = configs[i];
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.inherit = 1;
+
+      global_stats.hardware_fds[i] = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+      if (global_stats.hardware_fds[i] == -1)
+        global_stats.has_hardware_counters = false;
+    }
+
+  if (!global_stats.has_hardware_counters)
+    {
+      for (auto fd: global_stats.hardware_fds)
+        if (fd != -1)
+          close(fd);
+    }
+
+  global_stats.is_enabled = true;
+#endif
+}
+
+// Should be called once all threads which could be counting are finished.
+void
+stats_report(FILE *file)
+{
+  if (!global_stats.is_enabled)
+    return;
+
+  uint64_t nanoseconds[Stats_Phase_Count] = { };
+  uint64_t calls[Stats_Phase_Count] = { };
+  uint64_t counters[Stats_Counter_Count] = { };
+
+  for (auto block = global_stats.blocks.load(); block; block = block->next)
+    {
+      for (size_t i = 0; i < Stats_Phase_Count; i++)
+        {
+          nanoseconds[i] += block->nanoseconds[i];
+          calls[i] += block->calls[i];
+        }
+
+      for (size_t i = 0; i < Stats_Counter_Count; i++)
+        counters[i] += block->counters[i];
+    }
+
+  fprintf(file, "{\n  \"hardware_counters\": %s,\n", global_stats.has_hardware_counters ? "true" : "false");
+  if (global_stats.has_hardware_counters)
+    fprintf(file, "  \"hardware_counters_cover\": \"calling thread and threads that exited during the phase\",\n");
+  fprintf(file, "  \"phases\": {\n");
+
+  for (size_t i = 0; i < Stats_Phase_Count; i++)
+    {
+      fprintf(file, "    \"%s\": { \"seconds\": %.6f, \"calls\": %" PRIu64, STATS_PHASE_NAMES[i], nanoseconds[i] * 1e-9, calls[i]);
+
+      if (i < Stats_Main_Phase_Count && global_stats.has_hardware_counters)
+        for (size_t j = 0; j < Stats_Hardware_Count; j++)
+          fprintf(file, ", \"%s\": %" PRIu64, STATS_HARDWARE_NAMES[j], global_stats.hardware[i][j]);
+
+      fprintf(file, " }%s\n", i + 1 < Stats_Phase_Count ? "," : "");
+    }
+
+  fprintf(file, "  },\n  \"counters\": {\n");
+
+  for (size_t i = 0; i < Stats_Counter_Count; i++)
+    fprintf(file, "    \"%s\": %" PRIu64 "%s\n", STATS_COUNTER_NAMES[i], counters[i], i + 1 < Stats_Counter_Count ? "," : "");
+
+  fprintf(file, "  }\n}\n");
+}
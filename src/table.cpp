@@ -1,4 +1,4 @@
-enum TableCellType
+enum TableCellType: uint8_t
   {
     Table_Cell_Integer,
     Table_Cell_Decimal,
@@ -38,29 +38,92 @@ struct TableCell
   }
 };
 
+// Value of a cell as it is stored in a column. Strings are stored as ids into 'Table::strings'.
+union TableValue
+{
+  i64 integer;
+  f64 decimal;
+  uint32_t string;
+};
+
+struct TableColumn
+{
+  TableCellType type;
+  std::vector<TableValue> values;
+  // Only filled if cells of the column have different types, 'type' is meaningless then.
+  std::vector<TableCellType> types;
+
+  bool is_mixed()
+  {
+    return !types.empty();
+  }
+
+  TableCellType type_at(size_t row)
+  {
+    return types.empty() ? type : types[row];
+  }
+
+  void push(TableCellType cell_type, TableValue value)
+  {
+    if (types.empty() && cell_type != type)
+      types.assign(values.size(), type);
+
+    if (!types.empty())
+      types.push_back(cell_type);
+
+    values.push_back(value);
+  }
+};
+
+// Cells are stored column by column, since that's how tables are scanned.
 struct Table
 {
-  std::vector<TableCell> data;
+  std::vector<TableColumn> columns;
   size_t rows = 0, cols = 0;
-  std::set<std::string> string_pool;
+  // Names of columns, empty if table didn't have a header.
+  std::vector<std::string> header;
+  // Strings in the pool point into the source.
+  SourceBuffer source;
+  StringInterner string_pool;
 
-  TableCell &grab(size_t row, size_t col)
+  TableCell grab(size_t row, size_t col)
   {
     assert(row < rows && col < cols);
-    return data[row * cols + col];
+    auto &column = columns[col];
+    auto value = column.values[row];
+    auto cell = TableCell{ };
+    cell.type = column.type_at(row);
+
+    switch (cell.type)
+      {
+      case Table_Cell_Integer:
+        cell.as.integer = value.integer;
+        break;
+      case Table_Cell_Decimal:
+        cell.as.decimal = value.decimal;
+        break;
+      case Table_Cell_String:
+        cell.as.string = string_pool[value.string];
+        break;
+      }
+
+    return cell;
   }
 
   void print()
   {
-    std::cout << "Rows:    " << rows
+    std::cout << "Rows:    " << rows + !header.empty()
               << "\nColumns: " << cols
               << '\n';
 
+    for (size_t j = 0; j < header.size(); j++)
+      std::cout << header[j] << (j + 1 < cols ? ',' : '\n');
+
     for (size_t i = 0; i < rows; i++)
       {
         for (size_t j = 0; j < cols; j++)
           {
-            auto &cell = grab(i, j);
+            auto cell = grab(i, j);
             switch (cell.type)
               {
               case Table_Cell_Integer:
@@ -80,23 +143,39 @@ struct Table
   }
 };
 
-Table
-parse_csv_from_string(const char *filepath, std::string &source)
-{
-  auto table = Table{ };
-  auto t = Tokenizer{ };
-  t.filepath = filepath;
-  t.source = source;
+#define PARALLEL_PARSE_MIN_CHUNK_SIZE (1 << 20)
 
-  size_t cells_in_row = 0;
+// Parses rows until the end of tokenizer's source into table, without touching table's source.
+// If tokenizer is quiet, returns false on error instead of exiting.
+bool
+parse_csv_rows(Tokenizer &t, Table &table, bool has_header)
+{
+  auto row = std::vector<TableCell>{ };
+  // Header keeps cells as they are written, numbers formatted back from their values could differ, like '1.5' for '1.50'.
+  auto header_row = std::vector<std::string_view>{ };
 
   if (t.peek() == Token_New_Line)
     t.advance();
 
-  while (t.peek() != Token_End_Of_File)
+  while (!t.failed)
     {
       auto token = t.grab();
-      t.advance();
+
+      // Last row doesn't have to end with new line, it ends at the end of file then, like in 'CsvStreamReader'.
+      if (token.type == Token_End_Of_File)
+        {
+          if (row.empty())
+            break;
+
+          token.type = Token_New_Line;
+        }
+      else
+        {
+          t.advance();
+        }
+
+      if (has_header && token.type != Token_Comma && token.type != Token_New_Line)
+        header_row.push_back(token.text);
 
       switch (token.type)
         {
@@ -109,8 +188,7 @@ parse_csv_from_string(const char *filepath, std::string &source)
             auto cell = TableCell{ };
             cell.type = Table_Cell_Integer;
             cell.as.integer = value;
-            table.data.push_back(cell);
-            ++cells_in_row;
+            row.push_back(cell);
 
             t.expect_comma_or_new_line();
           }
@@ -133,8 +211,7 @@ parse_csv_from_string(const char *filepath, std::string &source)
             auto cell = TableCell{ };
             cell.type = Table_Cell_Decimal;
             cell.as.decimal = integral_part + fractional_part;
-            table.data.push_back(cell);
-            ++cells_in_row;
+            row.push_back(cell);
 
             t.expect_comma_or_new_line();
           }
@@ -142,12 +219,10 @@ parse_csv_from_string(const char *filepath, std::string &source)
           break;
         case Token_String:
           {
-            auto [it, _] = table.string_pool.emplace(token.text);
             auto cell = TableCell{ };
             cell.type = Table_Cell_String;
-            cell.as.string = *it;
-            table.data.push_back(cell);
-            ++cells_in_row;
+            cell.as.string = token.text;
+            row.push_back(cell);
 
             t.expect_comma_or_new_line();
           }
@@ -155,7 +230,10 @@ parse_csv_from_string(const char *filepath, std::string &source)
           break;
         case Token_Comma:
           {
-            PRINT_ERROR0(t.filepath, token.line_info, "unexpected ','.");
+            if (t.quiet)
+              return false;
+
+            PRINT_ERROR0(t.filepath, t.line_info_at(token.offset), "unexpected ','.");
             exit(EXIT_FAILURE);
           }
 
@@ -165,17 +243,57 @@ parse_csv_from_string(const char *filepath, std::string &source)
             if (table.cols == 0)
               {
                 // Columns count should only be zero on first iteration.
-                assert(cells_in_row > 0);
-                table.cols = cells_in_row;
+                assert(row.size() > 0);
+                table.cols = row.size();
+                table.columns.resize(table.cols);
               }
-            else if (cells_in_row != table.cols)
+            else if (row.size() != table.cols)
               {
-                PRINT_ERROR(t.filepath, token.line_info, "expected %zu row(s), but got %zu.", table.cols, cells_in_row);
+                if (t.quiet)
+                  return false;
+
+                PRINT_ERROR(t.filepath, t.line_info_at(token.offset), "expected %zu row(s), but got %zu.", table.cols, row.size());
                 exit(EXIT_FAILURE);
               }
 
-            ++table.rows;
-            cells_in_row = 0;
+            if (has_header)
+              {
+                for (auto text: header_row)
+                  table.header.emplace_back(text);
+
+                has_header = false;
+              }
+            else
+              {
+                for (size_t i = 0; i < table.cols; i++)
+                  {
+                    auto &cell = row[i];
+                    auto value = TableValue{ };
+
+                    switch (cell.type)
+                      {
+                      case Table_Cell_Integer:
+                        value.integer = cell.as.integer;
+                        break;
+                      case Table_Cell_Decimal:
+                        value.decimal = cell.as.decimal;
+                        break;
+                      case Table_Cell_String:
+                        value.string = table.string_pool.intern(cell.as.string);
+                        break;
+                      }
+
+                    // Type of the column is the type of its first cell.
+                    if (table.rows == 0)
+                      table.columns[i].type = cell.type;
+
+                    table.columns[i].push(cell.type, value);
+                  }
+
+                ++table.rows;
+              }
+
+            row.clear();
           }
 
           break;
@@ -185,27 +303,268 @@ parse_csv_from_string(const char *filepath, std::string &source)
         }
     }
 
-  return table;
+  return !t.failed;
 }
 
 Table
-parse_csv_from_file(const char *filepath)
+parse_csv_from_string(const char *filepath, SourceBuffer source, bool has_header)
 {
-  auto string = read_entire_file(filepath);
-  return parse_csv_from_string(filepath, string);
+  auto table = Table{ };
+  table.source = std::move(source);
+  auto t = Tokenizer{ };
+  t.filepath = filepath;
+  t.source = table.source.text;
+
+  parse_csv_rows(t, table, has_header);
+
+  return table;
 }
 
+// Splits source at line boundaries and parses every part on its own thread. Result is the same as of 'parse_csv_from_string'.
 Table
-parse_csv_from_stdin()
+parse_csv_from_string_in_parallel(const char *filepath, SourceBuffer source, bool has_header, size_t thread_count)
 {
-  auto string = std::string{ };
-  auto buffer = std::string{ };
+  auto text = source.text;
+  thread_count = std::max(std::min(thread_count, text.size() / PARALLEL_PARSE_MIN_CHUNK_SIZE), size_t(1));
+
+  if (thread_count == 1)
+    return parse_csv_from_string(filepath, std::move(source), has_header);
+
+  // Chunks start on first non whitespace character after new line, so whitespace between rows always ends
+  // up in one chunk and is tokenized into single new line, just like when parsing serially.
+  auto splits = std::vector<size_t>{ };
+  splits.push_back(0);
+
+  for (size_t i = 1; i < thread_count; i++)
+    {
+      auto split = text.find('\n', std::max(text.size() * i / thread_count, splits.back()));
+      if (split == std::string_view::npos)
+        break;
+
+      while (split < text.size() && isspace((unsigned char)text[split]))
+        ++split;
+
+      if (split > splits.back() && split < text.size())
+        splits.push_back(split);
+    }
+
+  splits.push_back(text.size());
+
+  // Chunks are tables without source, their strings point into the shared one.
+  auto chunks = std::vector<Table>{ };
+  chunks.resize(splits.size() - 1);
+  auto is_ok = std::make_unique<bool[]>(chunks.size());
+
+  parallel_for(chunks.size(), [&](size_t i)
+  {
+    auto t = Tokenizer{ };
+    t.filepath = filepath;
+    // Keep preceding text in the source, so offsets and line numbers are global.
+    t.source = text.substr(0, splits[i + 1]);
+    t.offset = splits[i];
+    t.quiet = true;
+    is_ok[i] = parse_csv_rows(t, chunks[i], has_header && i == 0);
+  });
+
+  auto table = Table{ };
+  table.source = std::move(source);
+  table.cols = chunks[0].cols;
+  table.header = std::move(chunks[0].header);
+
+  auto should_redo = false;
+  // Row offset of every chunk in the merged table.
+  auto offsets = std::vector<size_t>{ };
+  offsets.resize(chunks.size() + 1);
+
+  for (size_t i = 0; i < chunks.size(); i++)
+    {
+      auto &chunk = chunks[i];
+      should_redo = !is_ok[i] || (chunk.cols != 0 && chunk.cols != table.cols) || should_redo;
+      offsets[i + 1] = offsets[i] + chunk.rows;
+    }
 
-  while (std::getline(std::cin, buffer))
+  if (should_redo)
     {
-      string.append(buffer);
-      string.push_back('\n');
+      // Serial parser exits with error message about the first error in the file.
+      return parse_csv_from_string(filepath, std::move(table.source), has_header);
+    }
+
+  table.rows = offsets.back();
+  table.columns.resize(table.cols);
+
+  // Chunks are merged in order, so ids are given in order of first occurrence in the file, like when parsing serially.
+  auto string_ids = std::vector<std::vector<uint32_t>>{ };
+  string_ids.resize(chunks.size());
+
+  for (size_t i = 0; i < chunks.size(); i++)
+    for (auto string: chunks[i].string_pool.strings)
+      string_ids[i].push_back(table.string_pool.intern(string));
+
+  for (size_t j = 0; j < table.cols; j++)
+    {
+      auto &column = table.columns[j];
+      auto is_typed = false;
+      auto is_mixed = false;
+
+      for (auto &chunk: chunks)
+        {
+          if (chunk.rows == 0)
+            continue;
+
+          auto &part = chunk.columns[j];
+          is_mixed = part.is_mixed() || (is_typed && part.type != column.type) || is_mixed;
+          column.type = is_typed ? column.type : part.type;
+          is_typed = true;
+        }
+
+      column.values.resize(table.rows);
+      if (is_mixed)
+        column.types.resize(table.rows);
     }
 
-  return parse_csv_from_string("<stdin>", string);
+  parallel_for(chunks.size(), [&](size_t i)
+  {
+    auto &chunk = chunks[i];
+
+    for (size_t j = 0; j < chunk.cols && chunk.rows > 0; j++)
+      {
+        auto &part = chunk.columns[j];
+        auto &column = table.columns[j];
+
+        for (size_t row = 0; row < chunk.rows; row++)
+          {
+            auto type = part.type_at(row);
+            auto value = part.values[row];
+
+            if (type == Table_Cell_String)
+              value.string = string_ids[i][value.string];
+
+            column.values[offsets[i] + row] = value;
+            if (column.is_mixed())
+              column.types[offsets[i] + row] = type;
+          }
+
+        part = TableColumn{ };
+      }
+  });
+
+  return table;
+}
+
+Table
+parse_csv_from_file(const char *filepath)
+{
+  STATS_SCOPE(Stats_Phase_Parse);
+
+  auto source = map_entire_file(filepath);
+  return parse_csv_from_string_in_parallel(filepath, std::move(source), true, std::thread::hardware_concurrency());
 }
+
+#define STREAM_READ_SIZE (1 << 16)
+
+// Reads CSV from file descriptor in batches of whole lines, so it can be processed before all input has arrived.
+struct CsvStreamReader
+{
+  int fd;
+  const char *filepath;
+  // Maximum number of lines in a batch.
+  size_t batch_size;
+  // Unparsed input and line number of its beginning.
+  std::string buffer;
+  size_t line = 1;
+  size_t cols = 0;
+  bool is_eof = false;
+  // First line is the header, it goes to the first batch.
+  bool has_header = false;
+
+  // Returns offset just past the 'count'-th new line in buffer, or 0 if there are no new lines at all.
+  size_t find_lines_end(size_t count, size_t &lines)
+  {
+    size_t end = 0;
+    lines = 0;
+
+    while (lines < count)
+      {
+        auto next = buffer.find('\n', end);
+        if (next == std::string::npos)
+          break;
+
+        end = next + 1;
+        ++lines;
+      }
+
+    return end;
+  }
+
+  bool has_pending_input()
+  {
+    auto pfd = pollfd{ };
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    return poll(&pfd, 1, 0) > 0;
+  }
+
+  void read_more()
+  {
+    auto old_size = buffer.size();
+    buffer.resize(old_size + STREAM_READ_SIZE);
+
+    auto count = read(fd, &buffer[old_size], STREAM_READ_SIZE);
+    if (count < 0)
+      {
+        std::cerr << strerror(errno);
+        exit(EXIT_FAILURE);
+      }
+
+    buffer.resize(old_size + count);
+    is_eof = count == 0;
+  }
+
+  // Parses next batch into table. Batch is cut short if there is no more input yet, so rows are not held back
+  // waiting for the batch to fill up. Every row must have as many cells as the first one. Returns false at the end of input.
+  bool next_batch(Table &table)
+  {
+    size_t end = 0, lines = 0;
+
+    while (true)
+      {
+        end = find_lines_end(batch_size, lines);
+
+        if (lines == batch_size || (lines > 0 && !is_eof && !has_pending_input()))
+          break;
+
+        if (is_eof)
+          {
+            if (!buffer.empty() && buffer.back() != '\n')
+              buffer.push_back('\n');
+
+            end = find_lines_end(batch_size, lines);
+            break;
+          }
+
+        read_more();
+      }
+
+    if (end == 0)
+      return false;
+
+    table = Table{ };
+    table.source = copy_to_source_buffer({ buffer.data(), end });
+    table.cols = cols;
+    table.columns.resize(cols);
+
+    auto t = Tokenizer{ };
+    t.filepath = filepath;
+    t.source = table.source.text;
+    t.first_line = line;
+    parse_csv_rows(t, table, has_header);
+
+    has_header = false;
+    cols = table.cols;
+    line += lines;
+    buffer.erase(0, end);
+
+    return true;
+  }
+};
@@ -0,0 +1,185 @@
+// Times a waiting thread looks for tasks to steal before it goes to sleep.
+#define POOL_WAIT_SPIN_COUNT 64
+
+// Tasks spawned into a group can be waited for together.
+struct TaskGroup
+{
+  std::atomic<size_t> pending{ 0 };
+};
+
+struct Task
+{
+  std::function<void()> function;
+  TaskGroup *group;
+};
+
+// Work stealing pool: every worker has its own deque of tasks, it pushes and pops tasks at the back and steals
+// from the front of other deques when its own is empty. Thread that waits for a group also runs tasks,
+// it uses deque of worker 0.
+struct ThreadPool
+{
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> queued{ 0 };
+  std::mutex sleep_mutex;
+  std::condition_variable has_work;
+  bool is_stopping = false;
+
+  static thread_local ThreadPool *current_pool;
+  static thread_local size_t current_worker;
+
+  ThreadPool(size_t thread_count)
+  {
+    thread_count = std::max(thread_count, size_t(1));
+
+    for (size_t i = 0; i < thread_count; i++)
+      workers.push_back(std::make_unique<Worker>());
+
+    for (size_t i = 1; i < thread_count; i++)
+      threads.emplace_back([this, i]() { run_worker(i); });
+  }
+
+  ~ThreadPool()
+  {
+    {
+      auto lock = std::unique_lock{ sleep_mutex };
+      is_stopping = true;
+    }
+
+    has_work.notify_all();
+
+    for (auto &thread: threads)
+      thread.join();
+  }
+
+  size_t thread_count()
+  {
+    return workers.size();
+  }
+
+  // Index of the worker running on this thread, threads outside of the pool are treated as worker 0.
+  size_t worker_index()
+  {
+    return current_pool == this ? current_worker : 0;
+  }
+
+  void spawn(TaskGroup &group, std::function<void()> function)
+  {
+    ++group.pending;
+
+    {
+      auto &worker = *workers[worker_index()];
+      auto lock = std::unique_lock{ worker.mutex };
+      worker.tasks.push_back({ std::move(function), &group });
+    }
+
+    ++queued;
+
+    {
+      // Make sure sleeping worker either sees new task or is already waiting for notification.
+      auto lock = std::unique_lock{ sleep_mutex };
+    }
+
+    has_work.notify_one();
+  }
+
+  bool run_one(size_t index)
+  {
+    auto task = Task{ };
+    auto found = false;
+
+    for (size_t i = 0; i < workers.size() && !found; i++)
+      {
+        auto &worker = *workers[(index + i) % workers.size()];
+        auto lock = std::unique_lock{ worker.mutex };
+
+        if (worker.tasks.empty())
+          continue;
+
+        if (i == 0)
+          {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+          }
+        else
+          {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+          }
+
+        found = true;
+      }
+
+    if (!found)
+      return false;
+
+    --queued;
+    task.function();
+
+    // Last task of the group wakes threads which sleep waiting for it. Sleeping workers wake up too, and go back to sleep.
+    if (--task.group->pending == 0)
+      {
+        {
+          auto lock = std::unique_lock{ sleep_mutex };
+        }
+
+        has_work.notify_all();
+      }
+
+    return true;
+  }
+
+  // Runs tasks until every task of the group is finished. If there is nothing to run for a while, sleeps until
+  // the group is finished or a task is spawned.
+  void wait(TaskGroup &group)
+  {
+    auto index = worker_index();
+    size_t spins = 0;
+
+    while (group.pending > 0)
+      {
+        if (run_one(index))
+          {
+            spins = 0;
+            continue;
+          }
+
+        if (++spins < POOL_WAIT_SPIN_COUNT)
+          {
+            std::this_thread::yield();
+            continue;
+          }
+
+        auto lock = std::unique_lock{ sleep_mutex };
+        has_work.wait(lock, [&]() { return group.pending == 0 || queued > 0; });
+        spins = 0;
+      }
+  }
+
+  void run_worker(size_t index)
+  {
+    current_pool = this;
+    current_worker = index;
+
+    while (true)
+      {
+        if (run_one(index))
+          continue;
+
+        auto lock = std::unique_lock{ sleep_mutex };
+        has_work.wait(lock, [this]() { return is_stopping || queued > 0; });
+
+        if (is_stopping && queued == 0)
+          return;
+      }
+  }
+};
+
+thread_local ThreadPool *ThreadPool::current_pool = nullptr;
+thread_local size_t ThreadPool::current_worker = 0;
@@ -20,7 +20,198 @@ struct Token
 {
   TokenType type;
   std::string_view text;
-  LineInfo line_info;
+  // Line and column are only computed when reporting errors.
+  size_t offset;
+};
+
+constexpr size_t STRUCTURAL_BLOCK_SIZE = 64;
+
+// Stage one of tokenizer: bit 'i' of a mask is set if byte 'i' of the block belongs to the class.
+struct StructuralBlock
+{
+  uint64_t space;
+  uint64_t new_line;
+  uint64_t digit;
+  // Characters allowed in strings: letters, digits, '-' and '_'.
+  uint64_t word;
+};
+
+StructuralBlock
+classify_block_scalar(const char *at)
+{
+  auto block = StructuralBlock{ };
+
+  for (size_t i = 0; i < STRUCTURAL_BLOCK_SIZE; i++)
+    {
+      auto ch = (unsigned char)at[i];
+      uint64_t bit = uint64_t(1) << i;
+
+      if (isspace(ch))
+        block.space |= bit;
+      if (ch == '\n')
+        block.new_line |= bit;
+      if (isdigit(ch))
+        block.digit |= bit;
+      if (isalnum(ch) || ch == '-' || ch == '_')
+        block.word |= bit;
+    }
+
+  return block;
+}
+
+#if defined(__AVX2__)
+
+// Set lanes which are in range [min, min + count).
+inline __m256i
+bytes_in_range(__m256i bytes, char min, char count)
+{
+  auto shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(min));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(count - 1)), shifted);
+}
+
+StructuralBlock
+classify_block(const char *at)
+{
+  auto block = StructuralBlock{ };
+
+  for (size_t i = 0; i < STRUCTURAL_BLOCK_SIZE; i += 32)
+    {
+      auto bytes = _mm256_loadu_si256((const __m256i *)(at + i));
+      auto new_line = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+      auto space = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')), bytes_in_range(bytes, '\t', 5));
+      auto digit = bytes_in_range(bytes, '0', 10);
+      auto alpha = bytes_in_range(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 26);
+      auto word = _mm256_or_si256(_mm256_or_si256(alpha, digit),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('-')),
+                                                  _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_'))));
+
+      block.space    |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << i;
+      block.new_line |= uint64_t(uint32_t(_mm256_movemask_epi8(new_line))) << i;
+      block.digit    |= uint64_t(uint32_t(_mm256_movemask_epi8(digit))) << i;
+      block.word     |= uint64_t(uint32_t(_mm256_movemask_epi8(word))) << i;
+    }
+
+  return block;
+}
+
+#elif defined(__SSE2__)
+
+// Set lanes which are in range [min, min + count).
+inline __m128i
+bytes_in_range(__m128i bytes, char min, char count)
+{
+  auto shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(min));
+  return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(count - 1)), shifted);
+}
+
+StructuralBlock
+classify_block(const char *at)
+{
+  auto block = StructuralBlock{ };
+
+  for (size_t i = 0; i < STRUCTURAL_BLOCK_SIZE; i += 16)
+    {
+      auto bytes = _mm_loadu_si128((const __m128i *)(at + i));
+      auto new_line = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+      auto space = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), bytes_in_range(bytes, '\t', 5));
+      auto digit = bytes_in_range(bytes, '0', 10);
+      auto alpha = bytes_in_range(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 26);
+      auto word = _mm_or_si128(_mm_or_si128(alpha, digit),
+                               _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('-')),
+                                            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'))));
+
+      block.space    |= uint64_t(_mm_movemask_epi8(space)) << i;
+      block.new_line |= uint64_t(_mm_movemask_epi8(new_line)) << i;
+      block.digit    |= uint64_t(_mm_movemask_epi8(digit)) << i;
+      block.word     |= uint64_t(_mm_movemask_epi8(word)) << i;
+    }
+
+  return block;
+}
+
+#else
+
+StructuralBlock
+classify_block(const char *at)
+{
+  return classify_block_scalar(at);
+}
+
+#endif
+
+// Classifies source block by block and answers "where does this run of characters end" questions for stage two.
+struct StructuralIndexer
+{
+  std::string_view source;
+  size_t block_index = SIZE_MAX;
+  StructuralBlock block;
+
+  StructuralBlock &grab(size_t index)
+  {
+    if (index == block_index)
+      return block;
+
+    block_index = index;
+    auto start = index * STRUCTURAL_BLOCK_SIZE;
+
+    if (start + STRUCTURAL_BLOCK_SIZE <= source.size())
+      block = classify_block(source.data() + start);
+    else
+      {
+        // Don't read past the end of the source, bytes after it are treated as '\0'.
+        char padded[STRUCTURAL_BLOCK_SIZE] = { };
+        if (start < source.size())
+          memcpy(padded, source.data() + start, source.size() - start);
+        block = classify_block(padded);
+      }
+
+    return block;
+  }
+
+  // Returns offset of the first byte at or after 'offset' which doesn't belong to the class.
+  template<uint64_t StructuralBlock::*mask>
+  size_t skip(size_t offset)
+  {
+    while (offset < source.size())
+      {
+        auto bit = offset % STRUCTURAL_BLOCK_SIZE;
+        auto outside = ~(grab(offset / STRUCTURAL_BLOCK_SIZE).*mask) >> bit;
+
+        if (outside != 0)
+          return offset + __builtin_ctzll(outside);
+
+        offset += STRUCTURAL_BLOCK_SIZE - bit;
+      }
+
+    return source.size();
+  }
+
+  // Same as 'skip<&StructuralBlock::space>', but also tells whether skipped whitespace had new line.
+  size_t skip_spaces(size_t offset, bool &has_new_line)
+  {
+    has_new_line = false;
+
+    while (offset < source.size())
+      {
+        auto bit = offset % STRUCTURAL_BLOCK_SIZE;
+        auto &block = grab(offset / STRUCTURAL_BLOCK_SIZE);
+        auto outside = ~block.space >> bit;
+        auto new_lines = block.new_line >> bit;
+
+        if (outside != 0)
+          {
+            auto count = __builtin_ctzll(outside);
+            auto skipped = (uint64_t(1) << count) - 1;
+            has_new_line = (new_lines & skipped) != 0 || has_new_line;
+            return offset + count;
+          }
+
+        has_new_line = new_lines != 0 || has_new_line;
+        offset += STRUCTURAL_BLOCK_SIZE - bit;
+      }
+
+    return source.size();
+  }
 };
 
 struct Tokenizer
@@ -30,9 +221,16 @@ struct Tokenizer
   Token tokens_buffer[LOOKAHEAD];
   uint8_t token_start = 0;
   uint8_t token_count = 0;
-  LineInfo line_info;
+  size_t offset = 0;
   const char *filepath;
   std::string_view source;
+  // Line number of the beginning of the source, when it is only a part of a file.
+  size_t first_line = 1;
+  StructuralIndexer indexer;
+  // In quiet mode errors are only remembered and tokenizer pretends it reached the end of file.
+  // Used by parallel parser, which redoes the work serially to report the first error.
+  bool quiet = false;
+  bool failed = false;
 
   TokenType peek()
   {
@@ -58,6 +256,26 @@ struct Tokenizer
     --token_count;
   }
 
+  // Slow, only supposed to be used for error reporting.
+  LineInfo line_info_at(size_t offset)
+  {
+    auto line_info = LineInfo{ };
+    line_info.offset = offset;
+    line_info.line = first_line;
+
+    for (size_t i = 0; i < offset && i < source.size(); i++)
+      {
+        ++line_info.column;
+        if (source[i] == '\n')
+          {
+            ++line_info.line;
+            line_info.column = 1;
+          }
+      }
+
+    return line_info;
+  }
+
   void expect_comma_or_new_line()
   {
     switch (peek())
@@ -71,84 +289,83 @@ struct Tokenizer
       default:
         {
           auto token = grab();
-          PRINT_ERROR(filepath, token.line_info, "expected ',', new line or EOF, but got '%.*s'.", (int)token.text.size(), token.text.data());
+
+          if (quiet)
+            {
+              failed = true;
+              break;
+            }
+
+          PRINT_ERROR(filepath, line_info_at(token.offset), "expected ',', new line or EOF, but got '%.*s'.", (int)token.text.size(), token.text.data());
           exit(EXIT_FAILURE);
         }
       }
   }
 
-  void advance_line_info(char ch)
+  char char_at(size_t offset)
   {
-    ++line_info.offset;
-    ++line_info.column;
-    if (ch == '\n')
-      {
-        ++line_info.line;
-        line_info.column = 1;
-      }
+    return offset < source.size() ? source[offset] : '\0';
   }
 
   void buffer_token()
   {
-    auto at = &source[line_info.offset];
-    auto has_new_line = false;
-
-    while (isspace(*at))
+    if (indexer.source.data() != source.data())
       {
-        has_new_line = (*at == '\n') || has_new_line;
-        advance_line_info(*at++);
+        indexer = StructuralIndexer{ };
+        indexer.source = source;
       }
 
+    auto has_new_line = false;
+    offset = indexer.skip_spaces(offset, has_new_line);
+
     auto token = Token{};
     token.type = Token_End_Of_File;
-    token.text = { at, 0 };
-    token.line_info = line_info;
+    token.text = { source.data() + offset, 0 };
+    token.offset = offset;
+
+    auto ch = (unsigned char)char_at(offset);
 
     if (has_new_line)
       {
         token.type = Token_New_Line;
-        // Line info is not properly set, but I don't think it is needed.
+        // Offset is not properly set, but I don't think it is needed.
       }
-    else if (*at == '\0')
+    else if (ch == '\0')
       ;
-    else if (*at == ',')
+    else if (ch == ',')
       {
-        advance_line_info(*at++);
+        ++offset;
 
         token.type = Token_Comma;
-        token.text = { token.text.data(), size_t(at - token.text.data()) };
+        token.text = { token.text.data(), 1 };
       }
-    else if (isdigit(*at))
+    else if (isdigit(ch))
       {
-        do
-          advance_line_info(*at++);
-        while (isdigit(*at));
+        offset = indexer.skip<&StructuralBlock::digit>(offset);
 
         token.type = Token_Integer;
-        token.text = { token.text.data(), size_t(at - token.text.data()) };
 
-        if (*at == '.')
+        if (char_at(offset) == '.')
           {
-            do
-              advance_line_info(*at++);
-            while (isdigit(*at));
+            offset = indexer.skip<&StructuralBlock::digit>(offset + 1);
 
             token.type = Token_Decimal;
-            token.text = { token.text.data(), size_t(at - token.text.data()) };
           }
+
+        token.text = { token.text.data(), offset - token.offset };
       }
-    else if (isalpha(*at))
+    else if (isalpha(ch))
       {
-        do
-          advance_line_info(*at++);
-        while (isalnum(*at) || *at == '-' || *at == '_');
+        offset = indexer.skip<&StructuralBlock::word>(offset);
 
         token.type = Token_String;
-        token.text = { token.text.data(), size_t(at - token.text.data()) };
+        token.text = { token.text.data(), offset - token.offset };
       }
+    else if (quiet)
+      failed = true;
     else
       {
-        PRINT_ERROR(filepath, token.line_info, "unrecognized token '%c'.", *at);
+        PRINT_ERROR(filepath, line_info_at(token.offset), "unrecognized token '%c'.", ch);
         exit(EXIT_FAILURE);
       }
 
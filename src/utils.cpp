@@ -1,4 +1,8 @@
+#ifdef NDEBUG
+#define UNREACHABLE() __builtin_unreachable()
+#else
 #define UNREACHABLE() assert(false && "unreachable")
+#endif
 
 template<typename T>
 struct Flattened2DArray
@@ -20,13 +24,209 @@ struct Flattened2DArray
   }
 };
 
-std::string
-read_entire_file(const char *filepath)
+// Array which either owns its elements, or borrows them from memory that outlives it, like a mapped model file.
+// Borrowed arrays are read only.
+template<typename T>
+struct FlatArray
+{
+  std::vector<T> owned;
+  T *borrowed = nullptr;
+  size_t borrowed_size = 0;
+
+  void borrow(const T *values, size_t size)
+  {
+    owned.clear();
+    borrowed = (T *)values;
+    borrowed_size = size;
+  }
+
+  T *data()
+  {
+    return borrowed ? borrowed : owned.data();
+  }
+
+  size_t size()
+  {
+    return borrowed ? borrowed_size : owned.size();
+  }
+
+  bool empty()
+  {
+    return size() == 0;
+  }
+
+  T &operator[](size_t index)
+  {
+    assert(index < size());
+    return data()[index];
+  }
+
+  T *begin() { return data(); }
+  T *end()   { return data() + size(); }
+  T &front() { return (*this)[0]; }
+  T &back()  { return (*this)[size() - 1]; }
+
+  void push_back(const T &value)
+  {
+    assert(!borrowed);
+    owned.push_back(value);
+  }
+
+  void append(const T *values, size_t count)
+  {
+    assert(!borrowed);
+    owned.insert(owned.end(), values, values + count);
+  }
+
+  void resize(size_t size)
+  {
+    assert(!borrowed);
+    owned.resize(size);
+  }
+
+  void assign(size_t size, const T &value)
+  {
+    assert(!borrowed);
+    owned.assign(size, value);
+  }
+};
+
+#define ARENA_SLAB_SIZE (1 << 20)
+
+// Hands out memory from big slabs, which are all freed together with the arena, so only trivially destructible values
+// can live in it. Values never move.
+struct Arena
+{
+  std::vector<std::unique_ptr<char[]>> slabs;
+  char *cursor = nullptr;
+  char *end = nullptr;
+
+  // Returns 'count' value initialized elements.
+  template<typename T>
+  T *allocate(size_t count)
+  {
+    static_assert(std::is_trivially_destructible_v<T>);
+
+    auto size = count * sizeof(T);
+    auto start = cursor + (-(uintptr_t)cursor & (alignof(T) - 1));
+
+    if (!cursor || size > size_t(end - start))
+      {
+        // Values bigger than a slab get a slab of their own.
+        auto slab_size = std::max(size_t(ARENA_SLAB_SIZE), size + alignof(T));
+        slabs.emplace_back(new char[slab_size]);
+        cursor = slabs.back().get();
+        end = cursor + slab_size;
+        start = cursor + (-(uintptr_t)cursor & (alignof(T) - 1));
+      }
+
+    cursor = start + size;
+
+    auto result = (T *)start;
+    for (size_t i = 0; i < count; i++)
+      new (&result[i]) T{ };
+
+    return result;
+  }
+};
+
+// Fast generator of random numbers, same seed gives the same numbers everywhere.
+struct Random
+{
+  uint64_t state;
+
+  uint64_t next()
+  {
+    // SplitMix64.
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  size_t below(size_t count)
+  {
+    return next() % count;
+  }
+
+  f64 unit()
+  {
+    return (next() >> 11) * 0x1.0p-53;
+  }
+};
+
+// Calls 'function(i)' for every 'i' in [0, count), each on its own thread.
+template<typename Function>
+void
+parallel_for(size_t count, Function &&function)
+{
+  auto threads = std::vector<std::thread>{ };
+  threads.reserve(count);
+
+  for (size_t i = 1; i < count; i++)
+    threads.emplace_back(function, i);
+
+  if (count > 0)
+    function(0);
+
+  for (auto &thread: threads)
+    thread.join();
+}
+
+// Text of a parsed file. Cells and string pools keep views into it, so it has to live as long as the table does.
+// 'text' is always followed by '\0', tokenizer relies on it.
+struct SourceBuffer
 {
-  auto file = std::ifstream{ filepath };
-  auto result = std::string{ };
+  std::string_view text;
+  void *mapping = nullptr;
+  size_t mapping_size = 0;
+  std::unique_ptr<char[]> owned;
 
-  if (!file.is_open())
+  SourceBuffer() = default;
+
+  SourceBuffer(SourceBuffer &&other)
+  {
+    *this = std::move(other);
+  }
+
+  SourceBuffer &operator=(SourceBuffer &&other)
+  {
+    std::swap(text, other.text);
+    std::swap(mapping, other.mapping);
+    std::swap(mapping_size, other.mapping_size);
+    std::swap(owned, other.owned);
+    return *this;
+  }
+
+  ~SourceBuffer()
+  {
+    if (mapping)
+      munmap(mapping, mapping_size);
+  }
+};
+
+SourceBuffer
+copy_to_source_buffer(std::string_view string)
+{
+  auto result = SourceBuffer{ };
+  result.owned = std::make_unique<char[]>(string.size() + 1);
+  memcpy(result.owned.get(), string.data(), string.size());
+  result.owned[string.size()] = '\0';
+  result.text = { result.owned.get(), string.size() };
+
+  return result;
+}
+
+// Maps file read only. Doesn't copy anything, so peak memory is whatever pages tokenizer touches.
+SourceBuffer
+map_entire_file(const char *filepath)
+{
+  auto result = SourceBuffer{ };
+  size_t file_size = 0;
+  void *reserved = MAP_FAILED;
+
+  int fd = open(filepath, O_RDONLY);
+  if (fd == -1)
     {
       fprintf(stderr, "error: couldn't open '%s'.", filepath);
       exit(EXIT_FAILURE);
@@ -34,14 +234,40 @@ read_entire_file(const char *filepath)
 
   {
     struct stat stats;
-    if (stat(filepath, &stats) == -1)
+    if (fstat(fd, &stats) == -1)
       goto report_error;
-    result.resize(stats.st_size + 1);
+    file_size = stats.st_size;
+  }
+
+  {
+    // Reserve at least one byte more than file has, so there is always zeroed memory for '\0' after the text.
+    // Bytes after the end of file in the last page are zeroed by the kernel, and if file size is multiple of page size,
+    // the extra page is anonymous and also zeroed.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mapping_size = (file_size + page_size) / page_size * page_size;
+
+    reserved = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED)
+      goto report_error;
+
+    result.mapping = reserved;
+    result.mapping_size = mapping_size;
   }
 
-  file.read(&result[0], result.size() - 1);
-  result.back() = '\0';
-  file.close();
+  if (file_size > 0)
+    {
+      auto mapped = mmap(reserved, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+      if (mapped == MAP_FAILED)
+        goto report_error;
+
+      madvise(mapped, file_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+      madvise(mapped, file_size, MADV_HUGEPAGE);
+#endif
+    }
+
+  close(fd);
+  result.text = { (const char *)reserved, file_size };
 
   return result;
 
@@ -49,3 +275,21 @@ read_entire_file(const char *filepath)
   std::cerr << strerror(errno);
   exit(EXIT_FAILURE);
 }
+
+// Parses value of a command line option, exits unless it is a whole number in [min, max].
+size_t
+parse_count(const char *option, const char *text, size_t min, size_t max)
+{
+  char *end = nullptr;
+  errno = 0;
+  auto value = strtoul(text, &end, 10);
+
+  // 'strtoul' skips whitespace and negates values with a minus sign.
+  if (!isdigit((unsigned char)text[0]) || *end != '\0' || errno != 0 || value < min || value > max)
+    {
+      fprintf(stderr, "error: %s should be a number from %zu to %zu, but got '%s'.\n", option, min, max, text);
+      exit(EXIT_FAILURE);
+    }
+
+  return value;
+}
@@ -0,0 +1,131 @@
+#include "library.cpp"
+
+// Checks that a header written by '--export-cpp' classifies every row of the training file the same way as the model
+// saved by the same run, and compares their speed. Built by 'verify-codegen.sh' with 'CODEGEN_HEADER' set to the path
+// of the header and 'CODEGEN_NAMESPACE' to its namespace.
+
+#include CODEGEN_HEADER
+
+namespace generated = CODEGEN_NAMESPACE;
+
+// Every way of classifying is timed on at least this many rows, small datasets are classified several times over.
+#define VERIFY_MIN_CLASSIFIED_ROWS 1000000
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      fprintf(stderr, "usage: %s MODEL DATASET\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+  auto model_path = argv[1];
+  auto dataset_path = argv[2];
+
+  auto mapped_file = map_model_file(model_path);
+  auto categories = load_categories(mapped_file);
+  auto tree = load_decision_tree(mapped_file, categories);
+
+  // Samples are numbered like categories, so first column of the training file is dropped. Goal column stays, nothing
+  // looks at it.
+  auto samples = parse_csv_from_file(dataset_path);
+  samples.columns.erase(samples.columns.begin());
+  samples.header.erase(samples.header.begin());
+  samples.cols -= 1;
+
+  if (samples.cols != categories.cols)
+    {
+      fprintf(stderr, "error: '%s' doesn't have the columns of '%s'.\n", dataset_path, model_path);
+      exit(EXIT_FAILURE);
+    }
+
+  auto generated_samples = std::vector<generated::Sample>{ };
+  generated_samples.resize(samples.rows);
+
+  for (size_t row = 0; row < samples.rows; row++)
+    {
+      generated::visit_fields(generated_samples[row], [&](size_t column, auto &field)
+      {
+        using Field = std::decay_t<decltype(field)>;
+        auto cell = samples.grab(row, column);
+
+        // Fields which can't hold the cell stay empty, tree doesn't split on such columns of training rows.
+        if constexpr (std::is_same_v<Field, std::string_view>)
+          {
+            if (cell.type == Table_Cell_String)
+              field = cell.as.string;
+          }
+        else
+          {
+            if (cell.type == Table_Cell_Integer)
+              field = Field(cell.as.integer);
+            else if (cell.type == Table_Cell_Decimal)
+              field = Field(cell.as.decimal);
+          }
+      });
+    }
+
+  auto expected = std::vector<CategoryId>{ };
+  auto batch_results = std::vector<CategoryId>{ };
+  expected.resize(samples.rows);
+  batch_results.resize(samples.rows);
+
+  size_t mismatches = 0;
+  tree.classify_batch(samples, 0, samples.rows, batch_results.data());
+
+  for (size_t row = 0; row < samples.rows; row++)
+    {
+      expected[row] = tree.classify(samples, row);
+      auto result = generated::classify(generated_samples[row]);
+      auto result_id = result == generated::INVALID_CATEGORY ? INVALID_CATEGORY_ID : CategoryId(result);
+
+      if (result_id != expected[row] || batch_results[row] != expected[row])
+        {
+          fprintf(stderr, "error: row %zu of '%s' is classified as %zu, generated code gives %zu and batch gives %zu.\n",
+                  row, dataset_path, expected[row], result_id, batch_results[row]);
+          ++mismatches;
+        }
+    }
+
+  if (mismatches > 0)
+    {
+      fprintf(stderr, "error: %zu of %zu rows of '%s' are classified differently.\n", mismatches, samples.rows, dataset_path);
+      exit(EXIT_FAILURE);
+    }
+
+  auto passes = std::max(size_t(VERIFY_MIN_CLASSIFIED_ROWS) / std::max(samples.rows, size_t(1)), size_t(1));
+  size_t checksum = 0;
+
+  // Returns nanoseconds per row.
+  auto time = [&](auto &&function) -> f64
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; pass++)
+      function();
+    auto seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / f64(passes * samples.rows);
+  };
+
+  auto tree_ns = time([&]()
+  {
+    for (size_t row = 0; row < samples.rows; row++)
+      checksum += tree.classify(samples, row);
+  });
+
+  auto batch_ns = time([&]()
+  {
+    tree.classify_batch(samples, 0, samples.rows, batch_results.data());
+    checksum += batch_results[0];
+  });
+
+  auto generated_ns = time([&]()
+  {
+    for (auto &sample: generated_samples)
+      checksum += generated::classify(sample);
+  });
+
+  // Checksum is printed, so none of the loops is thrown away.
+  printf("%s: %zu rows agree, ns per row: classify %.1f, classify_batch %.1f, generated %.1f (%.1fx faster), checksum %zu\n",
+         dataset_path, samples.rows, tree_ns, batch_ns, generated_ns, tree_ns / generated_ns, checksum);
+}
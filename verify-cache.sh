@@ -0,0 +1,39 @@
+#!/bin/bash
+# Checks that the dataset cache prepared in memory and the one prepared out of core are the same byte for byte, so
+# either of them can be used by the other kind of run, and that both give the same tree.
+set -eu
+FLAGS="-Wall -Wextra -pedantic -O2 -march=native -DNDEBUG -pthread"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+g++ $FLAGS src/main.cpp -o "$WORK/decision-tree"
+
+for dataset in datasets/*.csv
+do
+  # Some datasets are rejected by the tokenizer, there is no cache to check then.
+  if ! "$WORK/decision-tree" "$dataset" --prepare --cache "$WORK/in-memory.cache" < /dev/null > /dev/null 2> "$WORK/errors"
+  then
+    echo "$dataset: skipped, no cache was prepared: $(head -n 1 "$WORK/errors")"
+    continue
+  fi
+
+  "$WORK/decision-tree" "$dataset" --prepare --out-of-core --cache "$WORK/out-of-core.cache" < /dev/null > /dev/null
+
+  if ! cmp -s "$WORK/in-memory.cache" "$WORK/out-of-core.cache"
+  then
+    echo "error: caches of '$dataset' prepared in memory and out of core differ."
+    exit 1
+  fi
+
+  # Only the tree is compared, the rest of the output depends on whether the cache was hit.
+  "$WORK/decision-tree" "$dataset" < /dev/null | sed -n '/^</,/^$/p' > "$WORK/in-memory.tree"
+  "$WORK/decision-tree" "$dataset" --out-of-core --cache "$WORK/out-of-core.cache" < /dev/null | sed -n '/^</,/^$/p' > "$WORK/out-of-core.tree"
+
+  if ! cmp -s "$WORK/in-memory.tree" "$WORK/out-of-core.tree"
+  then
+    echo "error: trees of '$dataset' built in memory and out of core differ."
+    exit 1
+  fi
+
+  echo "$dataset: caches and trees are the same"
+done
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Exports the tree of every dataset as a C++ header, compiles it into 'src/verify-codegen.cpp' and fails if generated
+# code classifies any row differently than the saved model. Header is named after a keyword, so its namespace is too.
+set -eu
+FLAGS="-Wall -Wextra -pedantic -O2 -march=native -DNDEBUG -pthread"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+g++ $FLAGS src/main.cpp -o "$WORK/decision-tree"
+
+# Labels which become the same identifier, a suffixed identifier which is also a label of a column before it,
+# and keywords, one of which becomes a label of a column before it.
+cat > "$WORK/colliding-labels.csv" <<CSV
+ID,x_2,x,x,x-1,size,long,default,new_,new,class
+1,red,1,a,2.5,small,1,a,3,0.5,yes
+2,red,2,b,1.5,large,2,b,4,1.5,no
+3,blue,1,b,3.5,small,3,a,3,2.5,yes
+4,blue,3,a,0.5,large,4,c,4,3.5,no
+5,green,2,a,2.0,small,5,b,3,0.5,yes
+6,green,3,b,4.5,large,6,c,4,1.5,no
+7,red,1,a,1.0,large,7,a,3,2.5,yes
+8,blue,2,b,3.0,small,8,b,4,3.5,no
+CSV
+
+for dataset in datasets/*.csv "$WORK/colliding-labels.csv"
+do
+  # Some datasets are rejected by the tokenizer, there is no tree to check then.
+  if ! "$WORK/decision-tree" "$dataset" --save-model "$WORK/model" --export-cpp "$WORK/class.hpp" < /dev/null > /dev/null 2> "$WORK/errors"
+  then
+    echo "$dataset: skipped, no tree was trained: $(head -n 1 "$WORK/errors")"
+    continue
+  fi
+
+  g++ $FLAGS -DCODEGEN_HEADER="\"$WORK/class.hpp\"" -DCODEGEN_NAMESPACE=class_ src/verify-codegen.cpp -o "$WORK/verify"
+  "$WORK/verify" "$WORK/model" "$dataset"
+done
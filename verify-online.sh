@@ -0,0 +1,45 @@
+#!/bin/bash
+# Checks that a leaf which got no training rows takes the most common class of the rows it gets from '--update',
+# instead of keeping the category of its parent because of rows it never had.
+set -eu
+FLAGS="-Wall -Wextra -pedantic -O2 -march=native -DNDEBUG -pthread"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+g++ $FLAGS src/main.cpp -o "$WORK/decision-tree"
+
+# Root splits on 'a', then 'a = p' splits on 'b', and 'b = z' gets no rows, so it is a leaf of 5 rows voting 'yes'.
+cat > "$WORK/train.csv" <<CSV
+ID,a,b,class
+1,p,x,yes
+2,p,x,yes
+3,p,x,yes
+4,p,y,no
+5,p,y,no
+6,q,z,yes
+7,q,z,no
+8,q,x,no
+9,q,y,yes
+10,r,x,no
+11,r,y,yes
+12,r,z,yes
+CSV
+
+cat > "$WORK/update.csv" <<CSV
+ID,a,b,class
+13,p,z,no
+14,p,z,no
+15,p,z,no
+CSV
+
+for builder in "" --level-wise
+do
+  result=$(echo "p,z" | "$WORK/decision-tree" "$WORK/train.csv" $builder --update "$WORK/update.csv" | tail -n 1)
+  if [ "$result" != "0: no" ]
+  then
+    echo "error: empty leaf built by '${builder:-recursive}' builder gives '$result' after update, should give '0: no'."
+    exit 1
+  fi
+
+  echo "${builder:-recursive}: empty leaf takes the class of its new rows"
+done